@@ -0,0 +1,262 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "includes/cache.h"
+#include "includes/chunk.h"
+#include "includes/object.h"
+#include "includes/value.h"
+#include "includes/vm.h"
+
+static bool write_constant(FILE* file, Value value);
+static bool read_constant(VM* vm, const uint8_t** cursor, const uint8_t* end, Value* out);
+static bool verify_code(Chunk* chunk);
+
+// FNV-1a, 64-bit: a stale cache only has to be told apart from the current source, not defended against
+uint64_t hash_source(const char* src, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)src[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// script.lox -> script.loxc, anything else gets .loxc appended; the caller frees the result
+char* cache_path_for(const char* path) {
+    size_t length = strlen(path);
+    bool is_lox = length >= 4 && strcmp(path + length - 4, ".lox") == 0;
+    char* cache_path = malloc(length + 6);
+    memcpy(cache_path, path, length);
+    strcpy(cache_path + length, is_lox ? "c" : ".loxc");
+    return cache_path;
+}
+
+// writes to a temporary file and renames it over path, so a concurrent run never maps a half-written cache
+bool write_chunk_cache(Chunk* chunk, uint64_t source_hash, const char* path) {
+    size_t length = strlen(path);
+    char* tmp_path = malloc(length + 5);
+    memcpy(tmp_path, path, length);
+    strcpy(tmp_path + length, ".tmp");
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        free(tmp_path);
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, LOXC_MAGIC, sizeof(header.magic));
+    header.version = LOXC_VERSION;
+    header.byte_order = LOXC_BYTE_ORDER;
+    header.code_count = (uint32_t)chunk->count;
+    header.source_hash = source_hash;
+    header.line_count = (uint32_t)chunk->line_count;
+    header.constant_count = (uint32_t)chunk->constants.count;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(chunk->lines, sizeof(LineRun), chunk->line_count, file) == (size_t)chunk->line_count;
+    ok = ok && fwrite(chunk->code, 1, chunk->count, file) == (size_t)chunk->count;
+    for (int i = 0; ok && i < chunk->constants.count; ++i) {
+        ok = write_constant(file, chunk->constants.values[i]);
+    }
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    return ok;
+}
+
+// maps the cache at path into chunk, which must be freshly initialised apart from its source. The code and the
+// line table are used straight from the mapping (private and writable, so quickening only copies the pages it
+// touches); only the constants are decoded, since strings have to be interned. Returns false if there's no usable
+// cache for this source, leaving chunk empty.
+bool load_chunk_cache(VM* vm, const char* path, uint64_t source_hash, Chunk* chunk) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    uint8_t* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    size_t lines_size = (size_t)header.line_count * sizeof(LineRun);
+    if (memcmp(header.magic, LOXC_MAGIC, sizeof(header.magic)) != 0 || header.version != LOXC_VERSION ||
+        header.byte_order != LOXC_BYTE_ORDER || header.source_hash != source_hash ||
+        header.code_count == 0 || header.constant_count > MAX_CONSTANTS ||
+        size - sizeof(header) < lines_size || size - sizeof(header) - lines_size < header.code_count) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    chunk->mapping = mapping;
+    chunk->mapping_size = size;
+    chunk->lines = (LineRun*)(mapping + sizeof(header));
+    chunk->line_count = (int)header.line_count;
+    chunk->code = mapping + sizeof(header) + lines_size;
+    chunk->count = (int)header.code_count;
+
+    // strings get allocated below, so the constants read so far have to stay reachable
+    Chunk* enclosing = vm->chunk;
+    vm->chunk = chunk;
+    const uint8_t* cursor = chunk->code + chunk->count;
+    const uint8_t* end = mapping + size;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < header.constant_count; ++i) {
+        Value value;
+        ok = read_constant(vm, &cursor, end, &value);
+        if (ok) {
+            push(vm, value);
+            write_value_arr(vm, &chunk->constants, value);
+            pop(vm);
+        }
+    }
+    vm->chunk = enclosing;
+
+    if (!ok || cursor != end || !verify_code(chunk)) {
+        ObjSource* source = chunk->source;  // the caller's, not ours to drop
+        free_chunk(vm, chunk);
+        chunk->source = source;
+        return false;
+    }
+    chunk->max_stack = chunk_stack_depth(chunk);
+    chunk->input_count = chunk_input_count(chunk);
+    return true;
+}
+
+void unmap_chunk_cache(Chunk* chunk) {
+    munmap(chunk->mapping, chunk->mapping_size);
+}
+
+static bool write_constant(FILE* file, Value value) {
+    uint8_t tag;
+    if (IS_NIL(value)) {
+        tag = CACHE_CONST_NIL;
+    } else if (IS_BOOL(value)) {
+        tag = AS_BOOL(value) ? CACHE_CONST_TRUE : CACHE_CONST_FALSE;
+    } else if (IS_NUMBER(value)) {
+        tag = CACHE_CONST_NUMBER;
+    } else {
+        tag = CACHE_CONST_STRING;
+    }
+    if (fwrite(&tag, 1, 1, file) != 1) {
+        return false;
+    }
+
+    if (tag == CACHE_CONST_NUMBER) {
+        double number = AS_NUMBER(value);
+        return fwrite(&number, sizeof(number), 1, file) == 1;
+    }
+    if (tag == CACHE_CONST_STRING) {
+        ObjString* str = AS_STRING(value);
+        uint32_t length = (uint32_t)str->length;
+        return fwrite(&length, sizeof(length), 1, file) == 1 && fwrite(str->chars, 1, length, file) == length;
+    }
+    return true;
+}
+
+static bool read_constant(VM* vm, const uint8_t** cursor, const uint8_t* end, Value* out) {
+    const uint8_t* p = *cursor;
+    if (p >= end) {
+        return false;
+    }
+
+    uint8_t tag = *p++;
+    switch (tag) {
+        case CACHE_CONST_NIL: *out = NIL_VAL; break;
+        case CACHE_CONST_FALSE: *out = BOOL_VAL(false); break;
+        case CACHE_CONST_TRUE: *out = BOOL_VAL(true); break;
+        case CACHE_CONST_NUMBER: {
+            double number;
+            if ((size_t)(end - p) < sizeof(number)) {
+                return false;
+            }
+            memcpy(&number, p, sizeof(number));
+            p += sizeof(number);
+            *out = NUMBER_VAL(number);
+            break;
+        }
+        case CACHE_CONST_STRING: {
+            uint32_t length;
+            if ((size_t)(end - p) < sizeof(length)) {
+                return false;
+            }
+            memcpy(&length, p, sizeof(length));
+            p += sizeof(length);
+            if ((size_t)(end - p) < length || length > INT32_MAX) {
+                return false;
+            }
+            *out = OBJ_VAL(copy_string(vm, (const char*)p, (int)length));
+            p += length;
+            break;
+        }
+        default: return false;
+    }
+
+    *cursor = p;
+    return true;
+}
+
+// one pass over the instructions (not a decode: the bytes are executed as they are) so a damaged or foreign
+// file can't send run() off the end of the code, the constant pool or either end of the value stack
+static bool verify_code(Chunk* chunk) {
+    if (chunk->line_count == 0 || chunk->lines[0].offset != 0) {
+        return false;
+    }
+    for (int i = 1; i < chunk->line_count; ++i) {
+        if (chunk->lines[i].offset <= chunk->lines[i - 1].offset || chunk->lines[i].offset >= chunk->count) {
+            return false;
+        }
+    }
+
+    int offset = 0;
+    int depth = 0;
+    uint8_t opcode = OP_RETURN;
+    while (offset < chunk->count) {
+        opcode = chunk->code[offset];
+        if (opcode >= OPCODE_COUNT) {
+            return false;
+        }
+        int length = opcode_length(opcode);
+        if (offset + length > chunk->count) {
+            return false;
+        }
+
+        int const_idx = -1;
+        if (opcode == OP_CONSTANT_LONG) {
+            const_idx = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) | (chunk->code[offset + 3] << 16);
+        } else if (length == 2 && opcode != OP_GET_INPUT) {
+            const_idx = chunk->code[offset + 1];
+        }
+        if (const_idx >= chunk->constants.count) {
+            return false;
+        }
+
+        // everything that doesn't push reads the top of the stack, and the binary ops the value under it too
+        int effect = opcode_stack_effect(opcode);
+        int operands = effect > 0 ? 0 : opcode == OP_RETURN ? 1 : 1 - effect;
+        if (depth < operands || (opcode == OP_RETURN && depth != 1)) {
+            return false;
+        }
+        depth += effect;
+        offset += length;
+    }
+    return opcode == OP_RETURN;
+}
@@ -1,33 +1,266 @@
 #include <stdlib.h>
+#include <string.h>
 
+#include "includes/cache.h"
 #include "includes/chunk.h"
 #include "includes/memory.h"
 #include "includes/value.h"
+#include "includes/vm.h"
+
+#define CONST_SLOT_EMPTY -1
+#define CONST_SLOT_TOMBSTONE -2
+#define CONST_MAX_LOAD 0.75
+
+static uint32_t hash_constant(Value value);
+static bool same_constant(Value a, Value b);
+static int* find_const_slot(Chunk* chunk, Value value);
+static void rehash_const_slots(VM* vm, Chunk* chunk);
 
 void init_chunk(Chunk* chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->max_stack = 0;
+    chunk->input_count = 0;
     init_value_arr(&chunk->constants);
+    chunk->const_slots = NULL;
+    chunk->const_slot_count = 0;
+    chunk->const_slot_capacity = 0;
+    chunk->lines = NULL;
+    chunk->line_count = 0;
+    chunk->line_capacity = 0;
+    chunk->source = NULL;
+    chunk->mapping = NULL;
+    chunk->mapping_size = 0;
 }
 
-void free_chunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+void free_chunk(VM* vm, Chunk* chunk) {
+    if (chunk->mapping != NULL) {
+        unmap_chunk_cache(chunk);
+    } else {
+        FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity, MEM_CHUNK_CODE);
+        FREE_ARRAY(vm, LineRun, chunk->lines, chunk->line_capacity, MEM_LINES);
+    }
+    free_value_arr(vm, &chunk->constants);
+    FREE_ARRAY(vm, int, chunk->const_slots, chunk->const_slot_capacity, MEM_CONSTANTS);
     init_chunk(chunk);
 }
 
-void write_chunk(Chunk* chunk, uint8_t byte) {
+void write_chunk(VM* vm, Chunk* chunk, uint8_t byte, int line) {
     if (chunk->capacity < chunk->count + 1) {
         int old_capacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(old_capacity);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
+        chunk->code = GROW_ARRAY(vm, uint8_t, chunk->code, old_capacity, chunk->capacity, MEM_CHUNK_CODE);
     }
 
     chunk->code[chunk->count] = byte;
     ++chunk->count;
+
+    if (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].line == line) {
+        return;     // extends the current run
+    }
+    if (chunk->line_capacity < chunk->line_count + 1) {
+        int old_capacity = chunk->line_capacity;
+        chunk->line_capacity = GROW_CAPACITY(old_capacity);
+        chunk->lines = GROW_ARRAY(vm, LineRun, chunk->lines, old_capacity, chunk->line_capacity, MEM_LINES);
+    }
+    chunk->lines[chunk->line_count].offset = chunk->count - 1;
+    chunk->lines[chunk->line_count].line = line;
+    ++chunk->line_count;
 }
 
-int add_constant(Chunk* chunk, Value value) {
-    write_value_arr(&chunk->constants, value);
-    return chunk->constants.count - 1;
+// drops everything from offset count onwards, line runs included
+void truncate_chunk(Chunk* chunk, int count) {
+    chunk->count = count;
+    while (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].offset >= count) {
+        --chunk->line_count;
+    }
+}
+
+// binary search for the run containing offset; only the error paths call this
+int get_line(Chunk* chunk, int offset) {
+    int low = 0;
+    int high = chunk->line_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (chunk->lines[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return chunk->line_count == 0 ? 0 : chunk->lines[low].line;
+}
+
+// returns the index of an identical constant already in the pool, or appends value
+int add_constant(VM* vm, Chunk* chunk, Value value) {
+    push(vm, value);    // keep the value reachable in case growing either array triggers a collection
+    if (chunk->const_slot_count + 1 > chunk->const_slot_capacity * CONST_MAX_LOAD) {
+        rehash_const_slots(vm, chunk);
+    }
+
+    int* slot = find_const_slot(chunk, value);
+    if (*slot >= 0) {
+        pop(vm);
+        return *slot;
+    }
+
+    if (*slot == CONST_SLOT_EMPTY) {
+        ++chunk->const_slot_count;
+    }
+    int index = chunk->constants.count;
+    *slot = index;
+    write_value_arr(vm, &chunk->constants, value);
+    pop(vm);
+    return index;
+}
+
+// for undoing the most recent add_constant() when nothing refers to that constant any more
+void remove_last_constant(Chunk* chunk) {
+    int index = chunk->constants.count - 1;
+    int* slot = find_const_slot(chunk, chunk->constants.values[index]);
+    *slot = CONST_SLOT_TOMBSTONE;
+    --chunk->constants.count;
+}
+
+// size in bytes of an instruction, operands included
+int opcode_length(uint8_t opcode) {
+    switch (opcode) {
+        case OP_CONSTANT:
+        case OP_ADD_CONST:
+        case OP_SUBTRACT_CONST:
+        case OP_MULTIPLY_CONST:
+        case OP_DIVIDE_CONST:
+        case OP_GREATER_CONST:
+        case OP_LESS_CONST:
+        case OP_GET_INPUT:
+            return 2;
+        case OP_CONSTANT_LONG:
+            return 4;
+        default: return 1;
+    }
+}
+
+// net number of values an instruction pushes (negative when it pops more than it pushes)
+int opcode_stack_effect(uint8_t opcode) {
+    switch (opcode) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_INPUT:
+            return 1;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD_NUM_NUM:
+        case OP_ADD_STR_STR:
+        case OP_SUBTRACT_NUM_NUM:
+        case OP_MULTIPLY_NUM_NUM:
+        case OP_DIVIDE_NUM_NUM:
+        case OP_GREATER_NUM_NUM:
+        case OP_LESS_NUM_NUM:
+        case OP_RETURN:
+            return -1;
+        default: return 0;  // unary ops and the *_CONST superinstructions replace the top of the stack in place
+    }
+}
+
+// the code is straight-line for now, so the deepest point is just the running maximum of the effects; once
+// there are jumps this has to follow every path instead
+int chunk_stack_depth(Chunk* chunk) {
+    int depth = 0;
+    int max_depth = 0;
+    for (int offset = 0; offset < chunk->count; offset += opcode_length(chunk->code[offset])) {
+        depth += opcode_stack_effect(chunk->code[offset]);
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+    return max_depth;
+}
+
+int chunk_input_count(Chunk* chunk) {
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; offset += opcode_length(chunk->code[offset])) {
+        if (chunk->code[offset] == OP_GET_INPUT && chunk->code[offset + 1] >= count) {
+            count = chunk->code[offset + 1] + 1;
+        }
+    }
+    return count;
+}
+
+// numbers are keyed by their bits so 0 and -0 stay separate constants; strings are interned, so the pointer
+// identifies them
+static uint32_t hash_constant(Value value) {
+    uint64_t bits = 0;
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(double));
+    } else if (IS_OBJ(value)) {
+        bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+    } else if (IS_BOOL(value)) {
+        bits = AS_BOOL(value) ? 2 : 1;
+    }
+
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static bool same_constant(Value a, Value b) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    if (IS_NUMBER(a) || IS_NUMBER(b)) {
+        return false;
+    }
+    return values_equal(a, b);
+}
+
+// the slot holding value's index, or the slot it should go into
+static int* find_const_slot(Chunk* chunk, Value value) {
+    uint32_t index = hash_constant(value) & (chunk->const_slot_capacity - 1);
+    int* tombstone = NULL;
+    for (;;) {
+        int* slot = &chunk->const_slots[index];
+        if (*slot == CONST_SLOT_EMPTY) {
+            return tombstone != NULL ? tombstone : slot;
+        }
+        if (*slot == CONST_SLOT_TOMBSTONE) {
+            if (tombstone == NULL) {
+                tombstone = slot;
+            }
+        } else if (same_constant(chunk->constants.values[*slot], value)) {
+            return slot;
+        }
+
+        index = (index + 1) & (chunk->const_slot_capacity - 1);
+    }
+}
+
+static void rehash_const_slots(VM* vm, Chunk* chunk) {
+    int old_capacity = chunk->const_slot_capacity;
+    FREE_ARRAY(vm, int, chunk->const_slots, old_capacity, MEM_CONSTANTS);
+
+    // tombstones don't survive a rehash, so only grow if the live constants actually need the room
+    if (chunk->constants.count + 1 > old_capacity * CONST_MAX_LOAD) {
+        chunk->const_slot_capacity = GROW_CAPACITY(old_capacity);
+    }
+    chunk->const_slots = ALLOCATE(vm, int, chunk->const_slot_capacity, MEM_CONSTANTS);
+    chunk->const_slot_count = chunk->constants.count;
+    for (int i = 0; i < chunk->const_slot_capacity; ++i) {
+        chunk->const_slots[i] = CONST_SLOT_EMPTY;
+    }
+    for (int i = 0; i < chunk->constants.count; ++i) {
+        *find_const_slot(chunk, chunk->constants.values[i]) = i;
+    }
 }
\ No newline at end of file
@@ -5,17 +5,32 @@
 #include "includes/compiler.h"
 #include "includes/scanner.h"
 #include "includes/chunk.h"
+#include "includes/memory.h"
+#include "includes/number.h"
 #include "includes/object.h"
 
+// the most recently emitted literal load; when it ends exactly at the end of the chunk it is the whole of the
+// expression just compiled, since bytecode is postfix and any operator applied to it would come after it
 typedef struct {
+    int start;
+    int end;
+    Value value;
+    bool added_constant;    // false when the pool already had this value, so someone else may be using the slot
+} Literal;
+
+// everything one compile() works on, so separate VMs can compile at the same time
+typedef struct {
+    VM* vm;
+    Scanner scanner;
+    Chunk* chunk;
     Token current;
     Token previous;
     bool had_error;
     bool panic_mode;
+    int depth;  // current parse_precedence() recursion depth
+    Literal last_literal;
 } Parser;
 
-Parser parser;
-
 typedef enum {
     PREC_NONE,
     PREC_ASSIGNMENT, // =
@@ -30,41 +45,48 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(Parser* parser);
 typedef struct {
     ParseFn prefix;
     ParseFn infix;
     Precedence precedence;
 } ParseRule;
 
-Chunk* compiling_chunk;
-
-static void expression();
-static void number();
-static void string();
-static void literal();
-static void grouping();
-static void unary();
-static void binary();
-
-static void parse_precedence(Precedence precedence);
+static void expression(Parser* parser);
+static void number(Parser* parser);
+static void string(Parser* parser);
+static void input(Parser* parser);
+static void literal(Parser* parser);
+static void grouping(Parser* parser);
+static void unary(Parser* parser);
+static void binary(Parser* parser);
+
+static void parse_precedence(Parser* parser, Precedence precedence);
+static void parse_precedence_nested(Parser* parser, Precedence precedence);
 static ParseRule *get_rule(TokenType type);
 
-static void emit_constant(Value value);
-static uint8_t make_constant(Value value);
-
-static void advance();
-static void consume(TokenType type, const char* msg);
-static void error_at_current(const char* msg);
-static void error(const char* msg);
-static void error_at(Token* token, const char* msg);
-
-static void emit_byte(uint8_t byte);
-static void emit_bytes(uint8_t byte1, uint8_t byte2);
-static Chunk* current_chunk();
-static void end_compiler();
-
-static void test_scanner();
+static void emit_constant(Parser* parser, Value value);
+static int make_constant(Parser* parser, Value value);
+static void emit_literal(Parser* parser, Value value);
+static bool tail_literal(Parser* parser, Literal* literal);
+static void drop_literal(Parser* parser, Literal* literal);
+static void replace_tail(Parser* parser, int start, Value value);
+static bool fold_unary(TokenType operator_type, Value operand, Value* result);
+static bool fold_binary(Parser* parser, TokenType operator_type, Value a, Value b, Value* result);
+static bool fused_opcode(TokenType operator_type, OpCode* fused);
+
+static void advance(Parser* parser);
+static void consume(Parser* parser, TokenType type, const char* msg);
+static void error_at_current(Parser* parser, const char* msg);
+static void error(Parser* parser, const char* msg);
+static void error_at(Parser* parser, Token* token, const char* msg);
+
+static void emit_byte(Parser* parser, uint8_t byte);
+static void emit_bytes(Parser* parser, uint8_t byte1, uint8_t byte2);
+static Chunk* current_chunk(Parser* parser);
+static void end_compiler(Parser* parser);
+
+static void test_scanner(Parser* parser);
 static void debug_parser_info(Parser* parser);
 
 ParseRule rules[] = {
@@ -90,6 +112,7 @@ ParseRule rules[] = {
     [TOKEN_IDENTIFIER] = {NULL, NULL, PREC_NONE},
     [TOKEN_STRING] = {string, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
+    [TOKEN_INPUT] = {input, NULL, PREC_NONE},
     [TOKEN_AND] = {NULL, NULL, PREC_NONE},
     [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
     [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
@@ -110,88 +133,166 @@ ParseRule rules[] = {
     [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
 };
 
-bool compile(const char* src, Chunk* chunk) {
-    init_scanner(src);
-    compiling_chunk = chunk;
+// constants of the chunk being compiled aren't reachable from the VM yet
+void mark_compiler_roots(VM* vm) {
+    Chunk* chunk = vm->compiling;
+    if (chunk == NULL) {
+        return;
+    }
+    for (int i = 0; i < chunk->constants.count; ++i) {
+        mark_value(vm, chunk->constants.values[i]);
+    }
+    mark_object(vm, (Obj*)chunk->source);
+}
 
+bool compile(VM* vm, const char* src, Chunk* chunk) {
+    Parser parser;
+    parser.vm = vm;
+    init_scanner(&parser.scanner, src);
+    parser.chunk = chunk;
     parser.had_error = false;
     parser.panic_mode = false;
-
-    advance();
-    expression();
-    consume(TOKEN_EOF, "Expect end of expression");
-    end_compiler();
+    parser.depth = 0;
+    parser.last_literal.end = -1;
+
+    Chunk* enclosing = vm->compiling;
+    vm->compiling = chunk;
+    advance(&parser);
+    expression(&parser);
+    consume(&parser, TOKEN_EOF, "Expect end of expression");
+    end_compiler(&parser);
+    vm->compiling = enclosing;
     return !parser.had_error;
 }
 
-static void expression() {
-    parse_precedence(PREC_ASSIGNMENT);
+static void expression(Parser* parser) {
+    parse_precedence(parser, PREC_ASSIGNMENT);
 }
 
-static void number() {
-    double value = strtod(parser.previous.start, NULL);
-    emit_constant(NUMBER_VAL(value));
+static void number(Parser* parser) {
+    double value = parse_number(parser->previous.start, parser->previous.length);
+    emit_literal(parser, NUMBER_VAL(value));
+}
+
+// $n reads stack slot n, so there's room for as many inputs as one byte can address
+static void input(Parser* parser) {
+    int index = 0;
+    for (int i = 1; i < parser->previous.length && index <= UINT8_MAX; ++i) {
+        index = index * 10 + (parser->previous.start[i] - '0');
+    }
+    if (index > UINT8_MAX) {
+        error(parser, "Can't read more than 256 inputs.");
+        return;
+    }
+    emit_bytes(parser, OP_GET_INPUT, (uint8_t)index);
 }
 
-static void string() {
-    emit_constant(OBJ_VAL(copy_string(parser.previous.start + 1, parser.previous.length - 2)));
+// literals from a mapped source point into it rather than being copied out
+static void string(Parser* parser) {
+    const char* chars = parser->previous.start + 1;
+    int length = parser->previous.length - 2;
+    ObjSource* source = current_chunk(parser)->source;
+    if (source != NULL) {
+        emit_literal(parser, OBJ_VAL(borrow_string(parser->vm, source, chars, length)));
+    } else {
+        emit_literal(parser, OBJ_VAL(copy_string(parser->vm, chars, length)));
+    }
 }
 
-static void literal() {
-    switch (parser.previous.type) {
-        case TOKEN_TRUE: { emit_byte(OP_TRUE); break; }
-        case TOKEN_FALSE: { emit_byte(OP_FALSE); break; }
-        case TOKEN_NIL: { emit_byte(OP_NIL); break; }
+static void literal(Parser* parser) {
+    switch (parser->previous.type) {
+        case TOKEN_TRUE: { emit_literal(parser, BOOL_VAL(true)); break; }
+        case TOKEN_FALSE: { emit_literal(parser, BOOL_VAL(false)); break; }
+        case TOKEN_NIL: { emit_literal(parser, NIL_VAL); break; }
         default: return;
     }
 }
 
-static void grouping() {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void unary() {
-    TokenType operator_type = parser.previous.type;
-    parse_precedence(PREC_UNARY);
+static void unary(Parser* parser) {
+    TokenType operator_type = parser->previous.type;
+    parse_precedence(parser, PREC_UNARY);
+
+    Literal operand;
+    Value folded;
+    if (tail_literal(parser, &operand) && fold_unary(operator_type, operand.value, &folded)) {
+        drop_literal(parser, &operand);
+        replace_tail(parser, operand.start, folded);
+        return;
+    }
+
     switch(operator_type) {
-        case TOKEN_MINUS: { emit_byte(OP_NEGATE); break; }
-        case TOKEN_BANG: { emit_byte(OP_NOT); break; }
+        case TOKEN_MINUS: { emit_byte(parser, OP_NEGATE); break; }
+        case TOKEN_BANG: { emit_byte(parser, OP_NOT); break; }
         default: return;
     }
 }
 
-static void binary() {
-    TokenType operator_type = parser.previous.type;
+static void binary(Parser* parser) {
+    TokenType operator_type = parser->previous.type;
+    Literal left;
+    bool left_is_literal = tail_literal(parser, &left);
+
     ParseRule* rule = get_rule(operator_type);
-    parse_precedence((Precedence)(rule->precedence + 1));
+    parse_precedence(parser, (Precedence)(rule->precedence + 1));
+
+    Literal right;
+    Value folded;
+    if (left_is_literal && tail_literal(parser, &right) && right.start == left.end &&
+        fold_binary(parser, operator_type, left.value, right.value, &folded)) {
+        drop_literal(parser, &right);
+        drop_literal(parser, &left);
+        replace_tail(parser, left.start, folded);
+        return;
+    }
+
+    OpCode fused;
+    if (fused_opcode(operator_type, &fused) && tail_literal(parser, &right) && current_chunk(parser)->code[right.start] == OP_CONSTANT) {
+        current_chunk(parser)->code[right.start] = fused;    // `OP_CONSTANT k; OP_ADD` -> `OP_ADD_CONST k`
+        parser->last_literal.end = -1;  // the tail is an operation now, not a bare literal
+        return;
+    }
 
     switch (operator_type) {
-        case TOKEN_PLUS: { emit_byte(OP_ADD); break; }
-        case TOKEN_MINUS: { emit_byte(OP_SUBTRACT); break; }
-        case TOKEN_STAR: { emit_byte(OP_MULTIPLY); break; }
-        case TOKEN_SLASH: { emit_byte(OP_DIVIDE); break; }
-        case TOKEN_EQUAL_EQUAL: { emit_byte(OP_EQUAL); break; }
-        case TOKEN_GREATER: { emit_byte(OP_GREATER); break; }
-        case TOKEN_LESS: { emit_byte(OP_LESS); break; }
+        case TOKEN_PLUS: { emit_byte(parser, OP_ADD); break; }
+        case TOKEN_MINUS: { emit_byte(parser, OP_SUBTRACT); break; }
+        case TOKEN_STAR: { emit_byte(parser, OP_MULTIPLY); break; }
+        case TOKEN_SLASH: { emit_byte(parser, OP_DIVIDE); break; }
+        case TOKEN_EQUAL_EQUAL: { emit_byte(parser, OP_EQUAL); break; }
+        case TOKEN_GREATER: { emit_byte(parser, OP_GREATER); break; }
+        case TOKEN_LESS: { emit_byte(parser, OP_LESS); break; }
         default: return;
     }
 }
 
-static void parse_precedence(Precedence precedence) {
-    advance();
-    ParseFn prefix_rule = get_rule(parser.previous.type)->prefix;
+static void parse_precedence(Parser* parser, Precedence precedence) {
+    if (parser->depth >= MAX_NESTING) {
+        error_at_current(parser, "Expression nested too deeply.");
+        return;
+    }
+    ++parser->depth;
+    parse_precedence_nested(parser, precedence);
+    --parser->depth;
+}
+
+static void parse_precedence_nested(Parser* parser, Precedence precedence) {
+    advance(parser);
+    ParseFn prefix_rule = get_rule(parser->previous.type)->prefix;
     if (prefix_rule == NULL) {
-        error("Expected expression");
+        error(parser, "Expected expression");
         return;
     }
 
-    prefix_rule();
+    prefix_rule(parser);
 
-    while (precedence <= get_rule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infix_rule = get_rule(parser.previous.type)->infix;
-        infix_rule();
+    while (precedence <= get_rule(parser->current.type)->precedence) {
+        advance(parser);
+        ParseFn infix_rule = get_rule(parser->previous.type)->infix;
+        infix_rule(parser);
     }
 }
 
@@ -199,85 +300,198 @@ static ParseRule* get_rule(TokenType type) {
     return &rules[type];
 }
 
-static void emit_constant(Value value) {
-    emit_bytes(OP_CONSTANT, make_constant(value));
+static void emit_constant(Parser* parser, Value value) {
+    int const_idx = make_constant(parser, value);
+    if (const_idx <= UINT8_MAX) {
+        emit_bytes(parser, OP_CONSTANT, (uint8_t)const_idx);
+        return;
+    }
+
+    emit_byte(parser, OP_CONSTANT_LONG);
+    emit_byte(parser, (uint8_t)(const_idx & 0xff));
+    emit_byte(parser, (uint8_t)((const_idx >> 8) & 0xff));
+    emit_byte(parser, (uint8_t)((const_idx >> 16) & 0xff));
 }
 
-static uint8_t make_constant(Value value) {
-    int const_idx = add_constant(current_chunk(), value);
-    if (const_idx > UINT8_MAX) {
-        error("too many constants in a single chunk :/");
+static int make_constant(Parser* parser, Value value) {
+    int const_idx = add_constant(parser->vm, current_chunk(parser), value);
+    if (const_idx >= MAX_CONSTANTS) {
+        error(parser, "too many constants in a single chunk :/");
         return 0;
     }
-    return (uint8_t)const_idx;
+    return const_idx;
+}
+
+static void emit_literal(Parser* parser, Value value) {
+    int constants_before = current_chunk(parser)->constants.count;
+    parser->last_literal.start = current_chunk(parser)->count;
+    if (IS_NIL(value)) {
+        emit_byte(parser, OP_NIL);
+    } else if (IS_BOOL(value)) {
+        emit_byte(parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emit_constant(parser, value);
+    }
+    parser->last_literal.end = current_chunk(parser)->count;
+    parser->last_literal.value = value;
+    parser->last_literal.added_constant = current_chunk(parser)->constants.count != constants_before;
+}
+
+static bool tail_literal(Parser* parser, Literal* literal) {
+    if (parser->last_literal.end != current_chunk(parser)->count) {
+        return false;
+    }
+    *literal = parser->last_literal;
+    return true;
+}
+
+// a constant the literal added itself, and that is still the last one in the pool, can't be used by anything
+// else (a later literal reusing it would have to come after it, and the right operand is dropped first)
+static void drop_literal(Parser* parser, Literal* literal) {
+    Chunk* chunk = current_chunk(parser);
+    if (!literal->added_constant) {
+        return;
+    }
+
+    int const_idx = chunk->code[literal->start + 1];
+    if (chunk->code[literal->start] == OP_CONSTANT_LONG) {
+        const_idx |= chunk->code[literal->start + 2] << 8;
+        const_idx |= chunk->code[literal->start + 3] << 16;
+    }
+    if (const_idx == chunk->constants.count - 1) {
+        remove_last_constant(chunk);
+    }
+}
+
+// swaps the literal loads from start to the end of the chunk for a single load of value
+static void replace_tail(Parser* parser, int start, Value value) {
+    truncate_chunk(current_chunk(parser), start);
+    emit_literal(parser, value);
+}
+
+// only folds what can't fail at runtime; anything that would raise an error is left for the VM to report
+static bool fold_unary(TokenType operator_type, Value operand, Value* result) {
+    switch (operator_type) {
+        case TOKEN_MINUS: {
+            if (!IS_NUMBER(operand)) { return false; }
+            *result = NUMBER_VAL(-AS_NUMBER(operand));
+            return true;
+        }
+        case TOKEN_BANG: {
+            *result = BOOL_VAL(is_falsey(operand));
+            return true;
+        }
+        default: return false;
+    }
+}
+
+static bool fold_binary(Parser* parser, TokenType operator_type, Value a, Value b, Value* result) {
+    if (operator_type == TOKEN_EQUAL_EQUAL) {
+        *result = BOOL_VAL(values_equal(a, b));
+        return true;
+    }
+    if (operator_type == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+        *result = OBJ_VAL(concat_strings(parser->vm, AS_STRING(a), AS_STRING(b)));
+        return true;
+    }
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+        return false;
+    }
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (operator_type) {
+        case TOKEN_PLUS: { *result = NUMBER_VAL(x + y); return true; }
+        case TOKEN_MINUS: { *result = NUMBER_VAL(x - y); return true; }
+        case TOKEN_STAR: { *result = NUMBER_VAL(x * y); return true; }
+        case TOKEN_SLASH: { *result = NUMBER_VAL(x / y); return true; }
+        case TOKEN_GREATER: { *result = BOOL_VAL(x > y); return true; }
+        case TOKEN_LESS: { *result = BOOL_VAL(x < y); return true; }
+        default: return false;
+    }
+}
+
+static bool fused_opcode(TokenType operator_type, OpCode* fused) {
+    switch (operator_type) {
+        case TOKEN_PLUS: { *fused = OP_ADD_CONST; return true; }
+        case TOKEN_MINUS: { *fused = OP_SUBTRACT_CONST; return true; }
+        case TOKEN_STAR: { *fused = OP_MULTIPLY_CONST; return true; }
+        case TOKEN_SLASH: { *fused = OP_DIVIDE_CONST; return true; }
+        case TOKEN_GREATER: { *fused = OP_GREATER_CONST; return true; }
+        case TOKEN_LESS: { *fused = OP_LESS_CONST; return true; }
+        default: return false;
+    }
 }
 
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Parser* parser) {
+    parser->previous = parser->current;
 
     for (;;) {
-        parser.current = scan_token();
-        // debug_parser_info(&parser);
-        if (parser.current.type != TOKEN_ERROR) { break; }
+        parser->current = scan_token(&parser->scanner);
+        // debug_parser_info(parser);
+        if (parser->current.type != TOKEN_ERROR) { break; }
 
-        error_at_current(parser.current.start);
+        error_at_current(parser, parser->current.start);
     }
 }
 
-static void consume(TokenType type, const char* msg) {
-    if (parser.current.type == type) {
-        advance();
+static void consume(Parser* parser, TokenType type, const char* msg) {
+    if (parser->current.type == type) {
+        advance(parser);
         return;
     }
-    error_at_current(msg);
+    error_at_current(parser, msg);
 }
 
-static void error_at_current(const char* msg) {
-    error_at(&parser.current, msg);
+static void error_at_current(Parser* parser, const char* msg) {
+    error_at(parser, &parser->current, msg);
 }
 
-static void error(const char* msg) {
-    error_at(&parser.previous, msg);
+static void error(Parser* parser, const char* msg) {
+    error_at(parser, &parser->previous, msg);
 }
 
-static void error_at(Token* token, const char* message) {
-    if (parser.panic_mode) { return; }
-    parser.panic_mode = true;
-    // fprintf(stderr, "[line %d] Error", token->line);
+static void error_at(Parser* parser, Token* token, const char* message) {
+    if (parser->panic_mode) { return; }
+    parser->panic_mode = true;
+    FILE* errors = parser->vm->errors;
+    fprintf(errors, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(errors, " at end");
     } else if (token->type == TOKEN_ERROR) {
         // Nothing.
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(errors, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
-    parser.had_error = true;
+    fprintf(errors, ": %s\n", message);
+    parser->had_error = true;
 }
 
 
-static void emit_byte(uint8_t byte) {
-    write_chunk(current_chunk(), byte);
+static void emit_byte(Parser* parser, uint8_t byte) {
+    write_chunk(parser->vm, current_chunk(parser), byte, parser->previous.line);
 }
 
-static void emit_bytes(uint8_t byte1, uint8_t byte2) {
-    emit_byte(byte1);
-    emit_byte(byte2);
+static void emit_bytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+    emit_byte(parser, byte1);
+    emit_byte(parser, byte2);
 }
 
-static Chunk* current_chunk() {
-    return compiling_chunk;
+static Chunk* current_chunk(Parser* parser) {
+    return parser->chunk;
 }
 
-static void end_compiler() {
-    emit_byte(OP_RETURN);
+static void end_compiler(Parser* parser) {
+    emit_byte(parser, OP_RETURN);
+    current_chunk(parser)->max_stack = chunk_stack_depth(current_chunk(parser));
+    current_chunk(parser)->input_count = chunk_input_count(current_chunk(parser));
 }
 
-static void test_scanner() {
+static void test_scanner(Parser* parser) {
     for (;;) {
-        Token token = scan_token();
+        Token token = scan_token(&parser->scanner);
         if (token.type == TOKEN_EOF) {
             break;
         }
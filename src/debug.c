@@ -4,6 +4,38 @@
 #include "includes/chunk.h"
 #include "includes/value.h"
 
+static const char* opcode_names[OPCODE_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_NOT] = "OP_NOT",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_ADD_CONST] = "OP_ADD_CONST",
+    [OP_SUBTRACT_CONST] = "OP_SUBTRACT_CONST",
+    [OP_MULTIPLY_CONST] = "OP_MULTIPLY_CONST",
+    [OP_DIVIDE_CONST] = "OP_DIVIDE_CONST",
+    [OP_GREATER_CONST] = "OP_GREATER_CONST",
+    [OP_LESS_CONST] = "OP_LESS_CONST",
+    [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+    [OP_GET_INPUT] = "OP_GET_INPUT",
+    [OP_ADD_NUM_NUM] = "OP_ADD_NUM_NUM",
+    [OP_ADD_STR_STR] = "OP_ADD_STR_STR",
+    [OP_SUBTRACT_NUM_NUM] = "OP_SUBTRACT_NUM_NUM",
+    [OP_MULTIPLY_NUM_NUM] = "OP_MULTIPLY_NUM_NUM",
+    [OP_DIVIDE_NUM_NUM] = "OP_DIVIDE_NUM_NUM",
+    [OP_GREATER_NUM_NUM] = "OP_GREATER_NUM_NUM",
+    [OP_LESS_NUM_NUM] = "OP_LESS_NUM_NUM",
+};
+
 void disassemble_chunk(Chunk* chunk, const char* name) {
     printf("== %s ==\n", name);
     // chunk_info(chunk, name);
@@ -15,39 +47,85 @@ void disassemble_chunk(Chunk* chunk, const char* name) {
 
 int disassemble_instruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
+    int line = get_line(chunk, offset);
+    if (offset > 0 && line == get_line(chunk, offset - 1)) {
+        printf("   | ");
+    } else {
+        printf("%4d ", line);
+    }
 
     uint8_t instruction = chunk->code[offset];
     // printf("instruction: %d", instruction);
     switch (instruction) {
         case OP_RETURN:
             // printf("inside the OP_RETURN case");
-            return simple_instruction("OP_RETURN", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_CONSTANT:   // actually takes an operand, the index to the constant stored in the constant pool
-            return constant_instruction("OP_CONSTANT", chunk, offset);
+            return constant_instruction(opcode_name(instruction), chunk, offset);
+        case OP_CONSTANT_LONG:
+            return constant_long_instruction(opcode_name(instruction), chunk, offset);
+        case OP_GET_INPUT:
+            return byte_instruction(opcode_name(instruction), chunk, offset);
         case OP_NIL:
-            return simple_instruction("OP_NIL", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_TRUE:
-            return simple_instruction("OP_TRUE", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_FALSE:
-            return simple_instruction("OP_FALSE", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_NEGATE:
-            return simple_instruction("OP_NEGATE", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_NOT:
-            return simple_instruction("OP_NOT", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_ADD:    // even though the arithmetic operators take operands, the bytecode instructions DO NOT
-            return simple_instruction("OP_ADD", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_SUBTRACT:
-            return simple_instruction("OP_SUBTRACT", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_MULTIPLY:
-            return simple_instruction("OP_MULTIPLY", offset);
+            return simple_instruction(opcode_name(instruction), offset);
         case OP_DIVIDE:
-            return simple_instruction("OP_DIVIDE", offset);
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_EQUAL:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_GREATER:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_LESS:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_ADD_CONST:
+            return constant_instruction(opcode_name(instruction), chunk, offset);
+        case OP_SUBTRACT_CONST:
+            return constant_instruction(opcode_name(instruction), chunk, offset);
+        case OP_MULTIPLY_CONST:
+            return constant_instruction(opcode_name(instruction), chunk, offset);
+        case OP_DIVIDE_CONST:
+            return constant_instruction(opcode_name(instruction), chunk, offset);
+        case OP_GREATER_CONST:
+            return constant_instruction(opcode_name(instruction), chunk, offset);
+        case OP_LESS_CONST:
+            return constant_instruction(opcode_name(instruction), chunk, offset);
+        case OP_ADD_NUM_NUM:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_ADD_STR_STR:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_SUBTRACT_NUM_NUM:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_MULTIPLY_NUM_NUM:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_DIVIDE_NUM_NUM:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_GREATER_NUM_NUM:
+            return simple_instruction(opcode_name(instruction), offset);
+        case OP_LESS_NUM_NUM:
+            return simple_instruction(opcode_name(instruction), offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
 }
 
+const char* opcode_name(uint8_t opcode) {
+    return opcode < OPCODE_COUNT && opcode_names[opcode] != NULL ? opcode_names[opcode] : "OP_UNKNOWN";
+}
+
 int simple_instruction(const char* name, int offset) {
     printf("%s\n", name);
     return offset + 1;
@@ -62,6 +140,19 @@ int constant_instruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+int byte_instruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-16s %4d\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+int constant_long_instruction(const char* name, Chunk* chunk, int offset) {
+    int const_idx = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) | (chunk->code[offset + 3] << 16);
+    printf("%-16s %4d ", name, const_idx);
+    print_value(chunk->constants.values[const_idx]);
+    printf("\n");
+    return offset + 4;
+}
+
 void chunk_info(Chunk* chunk, const char* name) {
     printf("== %s ==\n", name);
     printf("chunk->count: %d\t\tchunk->capacity: %d\n", chunk->count, chunk->capacity);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+#include "chunk.h"
+#include "vm.h"
+
+// .loxc files: a compiled, optimized chunk plus the hash of the source it came from. The file is written in
+// native byte order and opcode numbering, so LOXC_VERSION has to be bumped whenever OpCode or the layout changes.
+#define LOXC_MAGIC "LOXC"
+#define LOXC_VERSION 2
+#define LOXC_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;    // LOXC_BYTE_ORDER as the writer saw it; a mismatch means another endianness
+    uint32_t code_count;
+    uint64_t source_hash;
+    uint32_t line_count;
+    uint32_t constant_count;
+} CacheHeader;
+
+// layout after the header: line_count LineRuns, code_count bytes of code, then the constants, each a one-byte
+// CacheConstTag followed by its payload (a double, or a uint32 length and the characters)
+typedef enum {
+    CACHE_CONST_NIL,
+    CACHE_CONST_FALSE,
+    CACHE_CONST_TRUE,
+    CACHE_CONST_NUMBER,
+    CACHE_CONST_STRING,
+} CacheConstTag;
+
+uint64_t hash_source(const char* src, size_t length);
+char* cache_path_for(const char* path);
+bool write_chunk_cache(Chunk* chunk, uint64_t source_hash, const char* path);
+bool load_chunk_cache(VM* vm, const char* path, uint64_t source_hash, Chunk* chunk);
+void unmap_chunk_cache(Chunk* chunk);
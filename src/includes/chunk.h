@@ -18,17 +18,70 @@ typedef enum {
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
+    // superinstructions: the binary op with its right operand loaded from the constant pool (one-byte operand),
+    // fused because `OP_CONSTANT k; <op>` is the most frequent pair in arithmetic-heavy code
+    OP_ADD_CONST,
+    OP_SUBTRACT_CONST,
+    OP_MULTIPLY_CONST,
+    OP_DIVIDE_CONST,
+    OP_GREATER_CONST,
+    OP_LESS_CONST,
+    OP_CONSTANT_LONG,   // 24-bit little-endian constant index, for chunks with more than 256 constants
+    OP_GET_INPUT,       // one-byte operand: pushes input n, which run_script() left in stack slot n
+    // quickened forms: never emitted by the compiler; run() rewrites a generic op into one of these in place
+    // the first time it sees the operand types, and rewrites it back if the guard ever fails
+    OP_ADD_NUM_NUM,
+    OP_ADD_STR_STR,
+    OP_SUBTRACT_NUM_NUM,
+    OP_MULTIPLY_NUM_NUM,
+    OP_DIVIDE_NUM_NUM,
+    OP_GREATER_NUM_NUM,
+    OP_LESS_NUM_NUM,    // keep this last: the .loxc loader rejects anything above it
 } OpCode;
 
+#define OPCODE_COUNT (OP_LESS_NUM_NUM + 1)
+
+#define MAX_CONSTANTS (1 << 24)
+
+// one entry per run of consecutive bytes from the same source line; the run covers [offset, next run's offset)
+typedef struct {
+    int offset;
+    int line;
+} LineRun;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
+    int max_stack;  // deepest the value stack gets while running this chunk, filled in by the compiler
+    int input_count;    // 1 + the highest input the code reads, also filled in by the compiler
     ValueArr constants;
+    // open-addressing index over constants, so a repeated literal reuses its slot in the pool;
+    // each slot holds a constant index, or CONST_SLOT_EMPTY / CONST_SLOT_TOMBSTONE
+    int* const_slots;
+    int const_slot_count;   // slots in use, tombstones included
+    int const_slot_capacity;
+    // source lines, run-length encoded; only read when reporting an error, so it stays out of run()'s way
+    LineRun* lines;
+    int line_count;
+    int line_capacity;
+    // the mapped file being compiled, if any; string literals are borrowed from it, so the source passed to
+    // compile() must be source->chars
+    ObjSource* source;
+    // non-NULL when code and lines point into a mapped .loxc file rather than owned arrays
+    void* mapping;
+    size_t mapping_size;
 } Chunk;
 
 void init_chunk(Chunk* chunk);
-void free_chunk(Chunk* chunk);
-void write_chunk(Chunk* chunk, uint8_t byte);
+void free_chunk(VM* vm, Chunk* chunk);
+void write_chunk(VM* vm, Chunk* chunk, uint8_t byte, int line);
+void truncate_chunk(Chunk* chunk, int count);
+int get_line(Chunk* chunk, int offset);
 
-int add_constant(Chunk* chunk, Value value);
\ No newline at end of file
+int add_constant(VM* vm, Chunk* chunk, Value value);
+void remove_last_constant(Chunk* chunk);
+int opcode_length(uint8_t opcode);
+int opcode_stack_effect(uint8_t opcode);
+int chunk_stack_depth(Chunk* chunk);
+int chunk_input_count(Chunk* chunk);
\ No newline at end of file
@@ -2,4 +2,23 @@
 
 #include <stdbool.h>
 #include <stddef.h>
-#include <stdint.h>
\ No newline at end of file
+#include <stdint.h>
+
+// threaded dispatch needs the GNU "labels as values" extension, so fall back to the plain switch elsewhere
+// (or when built with -DNO_COMPUTED_GOTO)
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+// small allocations are served from size-class pools (see pool.h) unless built with -DNO_POOL_ALLOCATOR
+#if !defined(NO_POOL_ALLOCATOR)
+#define POOL_ALLOCATOR
+#endif
+
+// build with -DQUICKEN_STATS to count how many executions of the quickenable ops hit a specialized site
+// (printed on exit)
+
+// build with -DPROFILE_OPCODES to count and time every instruction run() executes, and which opcode follows which
+// (printed on exit); without it, run() carries none of the instrumentation
+
+// build with -DNAN_BOXING to pack every Value into a single 64-bit word instead of a tagged union (see value.h)
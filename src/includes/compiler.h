@@ -1,5 +1,11 @@
 #pragma once
 
 #include "chunk.h"
+#include "vm.h"
 
-bool compile(const char* src, Chunk* chunk);
\ No newline at end of file
+// the parser recurses once per nesting level, at roughly 180 bytes of C stack a level (-O2, x86-64), so this cap
+// keeps a maximal expression around 180 KB: well inside a small thread stack, with room for -O0 and sanitizer builds
+#define MAX_NESTING 1000
+
+bool compile(VM* vm, const char* src, Chunk* chunk);
+void mark_compiler_roots(VM* vm);
\ No newline at end of file
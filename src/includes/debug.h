@@ -5,8 +5,11 @@
 
 void disassemble_chunk(Chunk* chunk, const char* name);
 int disassemble_instruction(Chunk* chunk, int offset);
+const char* opcode_name(uint8_t opcode);
 
 int simple_instruction(const char* name, int offset);
 int constant_instruction(const char* name, Chunk* chunk, int offset);
+int byte_instruction(const char* name, Chunk* chunk, int offset);
+int constant_long_instruction(const char* name, Chunk* chunk, int offset);
 
 void chunk_info(Chunk* chunk, const char* name);
@@ -1,14 +1,61 @@
 #pragma once
 
 #include "common.h"
+#include "object.h"
 
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity * 2))
 
-#define GROW_ARRAY(type, pointer, old_count, new_count) \
-    (type*)reallocate(pointer, sizeof(type) * (old_count), sizeof(type) * (new_count))
+#define GROW_ARRAY(vm, type, pointer, old_count, new_count, category) \
+    (type*)reallocate(vm, pointer, sizeof(type) * (old_count), sizeof(type) * (new_count), category)
 
-#define FREE_ARRAY(type, pointer, old_count) reallocate(pointer, sizeof(type) * (old_count), 0)
+#define FREE_ARRAY(vm, type, pointer, old_count, category) \
+    reallocate(vm, pointer, sizeof(type) * (old_count), 0, category)
 
-#define ALLOCATE(type, count) ((type*)reallocate(NULL, 0, sizeof(type) * count))
+#define ALLOCATE(vm, type, count, category) ((type*)reallocate(vm, NULL, 0, sizeof(type) * count, category))
 
-void* reallocate(void* ptr, size_t old_size, size_t new_size);
\ No newline at end of file
+#define FREE(vm, type, pointer, category) reallocate(vm, pointer, sizeof(type), 0, category)
+
+// after a collection the next one is scheduled at (live bytes * GC_HEAP_GROW_FACTOR)
+#ifndef GC_HEAP_GROW_FACTOR
+#define GC_HEAP_GROW_FACTOR 2
+#endif
+
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+
+// what each reallocate() is for, so --mem-stats can break the heap down
+typedef enum {
+    MEM_CHUNK_CODE,
+    MEM_LINES,
+    MEM_CONSTANTS,
+    MEM_OBJECTS,
+    MEM_TABLES,
+    MEM_STACK,
+    MEM_CATEGORY_COUNT,
+} MemCategory;
+
+typedef struct {
+    size_t peak_bytes;
+    size_t allocations;     // fresh blocks
+    size_t reallocations;   // resizes of an existing block
+    size_t frees;
+    size_t category_bytes[MEM_CATEGORY_COUNT];
+    size_t category_peak[MEM_CATEGORY_COUNT];
+    size_t string_count;    // live strings, and the bytes of their chars (terminator included)
+    size_t string_bytes;
+} MemStats;
+
+typedef struct {
+    int collections;
+    size_t bytes_freed;
+    double total_pause;     // seconds
+    double max_pause;
+} GCStats;
+
+void* reallocate(VM* vm, void* ptr, size_t old_size, size_t new_size, MemCategory category);
+
+void mark_object(VM* vm, Obj* obj);
+void mark_value(VM* vm, Value value);
+void collect_garbage(VM* vm);
+void free_objects(VM* vm);
+void print_gc_stats(VM* vm);
+void print_mem_stats(VM* vm);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "common.h"
+
+// room for any formatted number: sign, 17 digits, point, leading zeros and exponent
+#define NUMBER_MAX_CHARS 32
+
+double parse_number(const char* chars, int length);
+int format_number(double value, char* buffer);
+int format_number_shortest(double value, char* buffer);
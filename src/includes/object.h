@@ -6,26 +6,51 @@
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
+#define IS_SOURCE(value) is_obj_type(value, OBJ_SOURCE)
 
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
 
 typedef enum {
     OBJ_STRING,
+    OBJ_SOURCE,
 } ObjType;
 
 struct Obj {
     ObjType type;
+    bool is_marked;
+    struct Obj* next;
+};
+
+// a source file mapped read-only into memory; it's unmapped once neither its chunk nor any string borrowed from it
+// is reachable
+struct ObjSource {
+    Obj obj;
+    const char* chars;      // NUL-terminated
+    size_t length;
+    size_t mapped_size;
 };
 
 struct ObjString {
     Obj obj;
     int length;
-    char* chars;
+    uint32_t hash;
+    // not NUL-terminated when borrowed: always go by length
+    const char* chars;
+    ObjSource* source;      // set for a string borrowed from a mapped source, whose chars point into it
+    char storage[];         // an owned string's chars, inline so it is a single allocation sharing the header's cache line
 };
 
-ObjString* take_string(char* chars, int length);
-ObjString* copy_string(const char* chars, int length);
+#define STRING_ALLOC_SIZE(length) (sizeof(ObjString) + (size_t)(length) + 1)
+
+ObjString* allocate_string(VM* vm, int length);
+ObjString* intern_string(VM* vm, ObjString* str);
+ObjString* copy_string(VM* vm, const char* chars, int length);
+ObjString* borrow_string(VM* vm, ObjSource* source, const char* chars, int length);
+ObjString* concat_strings(VM* vm, ObjString* a, ObjString* b);
+void free_string(VM* vm, ObjString* str);
+ObjSource* map_source(VM* vm, const char* path);
+void free_source(VM* vm, ObjSource* source);
 void print_obj(Value value);
 
 static inline bool is_obj_type(Value value, ObjType type) {
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "chunk.h"
+
+typedef struct {
+    int chunks;
+    int instructions_before;
+    int instructions_after;
+    int rewrites;
+} OptStats;
+
+void optimize_chunk(VM* vm, Chunk* chunk, OptStats* stats);
+void print_opt_stats(OptStats* stats);
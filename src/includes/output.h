@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "common.h"
+#include "value.h"
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+    NUMBER_FORMAT_G,        // what printf("%g") gives, and what print has always produced
+    NUMBER_FORMAT_SHORTEST, // the fewest digits that read back as the same double (see format_number_shortest())
+} NumberFormat;
+
+// what the program prints, collected here and handed to file a buffer at a time instead of a printf per value.
+// Anything else writing to the same file has to flush_output() first to keep the order.
+typedef struct {
+    FILE* file;
+    NumberFormat number_format;
+    size_t length;
+    char data[OUTPUT_BUFFER_SIZE];
+} Output;
+
+void init_output(Output* output, FILE* file);
+void flush_output(Output* output);
+void write_output(Output* output, const char* chars, size_t length);
+void write_value(Output* output, Value value);
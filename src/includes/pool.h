@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common.h"
+
+// small blocks come from per-size-class free lists carved out of large slabs; anything bigger than
+// POOL_MAX_SIZE goes straight to malloc. Blocks carry no header: the caller always passes the size back in,
+// which reallocate() already does.
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 256
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_SLAB_SIZE (64 * 1024)
+
+#define POOL_SIZE_CLASS(size) ((int)(((size) - 1) / POOL_GRANULE))
+
+typedef struct PoolBlock {
+    struct PoolBlock* next;
+} PoolBlock;
+
+typedef struct PoolSlab {
+    struct PoolSlab* next;
+    size_t padding;     // keeps the blocks that follow the header 16-byte aligned
+} PoolSlab;
+
+typedef struct {
+    PoolBlock* free_lists[POOL_CLASSES];
+    char* bump[POOL_CLASSES];   // untouched tail of the newest slab of each class
+    char* bump_end[POOL_CLASSES];
+    PoolSlab* slabs;
+} Pool;
+
+void init_pool(Pool* pool);
+void free_pool(Pool* pool);
+void* pool_alloc(Pool* pool, size_t size);
+void pool_free(Pool* pool, void* ptr, size_t size);
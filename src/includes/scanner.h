@@ -26,6 +26,7 @@ typedef enum {
     TOKEN_IDENTIFIER,
     TOKEN_STRING,
     TOKEN_NUMBER,
+    TOKEN_INPUT,    // $0, $1, ...: the values a host passes to run_script()
     // Keywords.
     TOKEN_AND,
     TOKEN_CLASS,
@@ -55,5 +56,12 @@ typedef struct {
     int line;
 } Token;
 
-void init_scanner(const char* src);
-Token scan_token();
\ No newline at end of file
+// everything the scanner knows about one source, so any number of them can be scanning at once
+typedef struct {
+    const char* start;
+    const char* current;
+    int line;
+} Scanner;
+
+void init_scanner(Scanner* scanner, const char* src);
+Token scan_token(Scanner* scanner);
\ No newline at end of file
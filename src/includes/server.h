@@ -0,0 +1,14 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// --serve protocol: every integer is a little-endian uint32.
+//   request:  source length, then the source
+//   response: status (0, or the exit code clox would give: 65 compile error, 70 runtime error), output length,
+//             error length, then what the script printed and what it reported as errors
+// A session ends when its input does, or at a request longer than SERVE_MAX_REQUEST.
+#define SERVE_MAX_REQUEST (64 << 20)
+
+bool serve_stream(VM* vm, int in, int out);
+int serve_socket(VM* vm, const char* path);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+
+typedef struct {
+    ObjString* key;
+    Value value;
+} Entry;
+
+typedef struct {
+    int count;
+    int capacity;
+    Entry* entries;
+} Table;
+
+void init_table(Table* table);
+void free_table(VM* vm, Table* table);
+bool table_set(VM* vm, Table* table, ObjString* key, Value value);
+bool table_delete(Table* table, ObjString* key);
+ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash);
+void table_remove_white(Table* table);
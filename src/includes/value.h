@@ -2,6 +2,57 @@
 
 #include "common.h"
 
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+typedef struct ObjSource ObjSource;
+typedef struct VM VM;
+
+#ifdef NAN_BOXING
+
+#include <string.h>
+
+// every value is a single 64-bit word: a real double, or a quiet NaN whose unused mantissa bits carry a tag
+// (nil/false/true) or, with the sign bit set, an Obj* (pointers fit in the low 48 bits)
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+
+typedef uint64_t Value;
+
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(num) num_to_value(num)
+#define OBJ_VAL(object_ptr) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object_ptr))
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_num(value)
+#define AS_OBJ(value) ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+static inline double value_to_num(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value num_to_value(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
+
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
@@ -9,9 +60,6 @@ typedef enum {
     VAL_OBJ,
 } ValueType;
 
-typedef struct Obj Obj;
-typedef struct ObjString ObjString;
-
 typedef struct {
     ValueType type;
     union {
@@ -35,6 +83,8 @@ typedef struct {
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
+#endif
+
 typedef struct {
     int capacity;
     int count;
@@ -42,7 +92,12 @@ typedef struct {
 } ValueArr;
 
 void init_value_arr(ValueArr* arr);
-void free_value_arr(ValueArr* arr);
-void write_value_arr(ValueArr* arr, Value value);
+void free_value_arr(VM* vm, ValueArr* arr);
+void write_value_arr(VM* vm, ValueArr* arr, Value value);
+
+static inline bool is_falsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)) || (IS_NUMBER(value) && (AS_NUMBER(value) == 0));
+}
 
+bool values_equal(Value a, Value b);
 void print_value(Value value);
\ No newline at end of file
@@ -1,16 +1,73 @@
 #pragma once
 
 #include "chunk.h"
+#include "memory.h"
+#include "optimizer.h"
+#include "output.h"
+#include "pool.h"
+#include "table.h"
 #include "value.h"
 
-#define STACK_MAX 256
+#define STACK_MAX 256  // initial size; interpret() grows the stack to fit each chunk's max_stack before running it
 
+// room on top of a chunk's max_stack for values the VM pushes to keep them reachable by the collector
+#define STACK_SLACK 4
+
+#ifdef QUICKEN_STATS
+typedef struct {
+    uint64_t generic;       // executions of a quickenable op in its generic form
+    uint64_t specialized;   // executions that went through a quickened site and passed its guard
+    uint64_t quickened;     // sites rewritten to a specialized form
+    uint64_t deopts;        // guards that failed and sent a site back to its generic form
+} QuickenStats;
+#endif
+
+#ifdef PROFILE_OPCODES
 typedef struct {
+    uint64_t counts[OPCODE_COUNT];
+    uint64_t ticks[OPCODE_COUNT];   // from the start of one instruction to the start of the next
+    uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];     // pairs[a][b]: times b ran straight after a
+    int previous;       // the instruction being timed, or -1 outside run()
+    int before;         // the instruction before that one, or -1
+    uint64_t started;   // the clock when it started
+} OpcodeProfile;
+#endif
+
+struct VM {
     Chunk* chunk;
+    Chunk* compiling;   // the chunk compile() is filling in, whose constants aren't reachable from chunk yet
     uint8_t* ip;
-    Value stack[STACK_MAX];
+    Value* stack;
+    int stack_capacity;
     Value* stack_top;
-} VM;
+    Value result;   // what the last chunk returned
+    Table strings;  // every live ObjString, so equal strings are always the same object
+
+    Obj* objects;   // intrusive list of every heap object, walked by the sweep phase
+    size_t bytes_allocated;
+    size_t next_gc;
+    int gray_count;
+    int gray_capacity;
+    Obj** gray_stack;
+    GCStats gc_stats;
+    MemStats mem_stats;
+    OptStats opt_stats;
+#ifdef QUICKEN_STATS
+    QuickenStats quicken_stats;
+#endif
+#ifdef PROFILE_OPCODES
+    OpcodeProfile profile;
+#endif
+    Pool pool;      // backs every small reallocate() when built with POOL_ALLOCATOR
+    Output output;  // what the program prints, on its way to stdout
+    FILE* errors;   // where compile and runtime errors are reported, stderr unless the host redirects them
+    bool listings;  // compile_chunk() prints each chunk's disassembly to stdout
+    // run_script() runs a private copy of the script's code, since run() quickens the code it executes; the copy
+    // is kept, quickened, for as long as the same script (script_id) keeps running on this VM
+    uint8_t* script_code;
+    int script_code_capacity;
+    uint64_t script_id;
+};
 
 typedef enum {
     INTERPRET_OK,
@@ -18,9 +75,32 @@ typedef enum {
     INTERPRET_RUNTIME_ERR,
 } InterpretResult;
 
-void init_vm();
-void free_vm();
+void init_vm(VM* vm);
+void reset_vm(VM* vm);
+void free_vm(VM* vm);
+#ifdef QUICKEN_STATS
+void add_quicken_stats(QuickenStats* total, const QuickenStats* stats);
+void print_quicken_stats(QuickenStats* stats);
+#endif
+#ifdef PROFILE_OPCODES
+void add_opcode_profile(OpcodeProfile* total, const OpcodeProfile* profile);
+void print_opcode_profile(OpcodeProfile* profile);
+#endif
+
+// a compiled, optimized expression that any number of VMs can run, from any threads, for as long as it lives.
+// Its constants live in a heap of their own that is frozen once compiling is done, so running the script only
+// ever reads from it.
+typedef struct {
+    VM heap;
+    Chunk chunk;
+    uint64_t id;    // unique for the life of the process, so a VM can't mistake a new script at a reused address
+} Script;
 
-InterpretResult interpret(const char* src);
-void push(Value value);
-Value pop();
\ No newline at end of file
+InterpretResult interpret(VM* vm, const char* src);
+InterpretResult compile_chunk(VM* vm, const char* src, Chunk* chunk);
+InterpretResult interpret_chunk(VM* vm, Chunk* chunk);
+Script* compile_script(const char* src);
+void free_script(Script* script);
+InterpretResult run_script(VM* vm, Script* script, const Value* inputs, int input_count, Value* result);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
\ No newline at end of file
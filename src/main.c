@@ -1,10 +1,28 @@
+// open_memstream(), getline(), strdup() and CLOCK_MONOTONIC are POSIX rather than C
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "includes/common.h"
+#include "includes/cache.h"
 #include "includes/chunk.h"
+#include "includes/compiler.h"
 #include "includes/debug.h"
+#include "includes/memory.h"
+#include "includes/object.h"
+#include "includes/output.h"
+#include "includes/scanner.h"
+#include "includes/server.h"
 #include "includes/value.h"
 #include "includes/vm.h"
 
@@ -15,27 +33,185 @@ static void print_args(int argc, char** argv);
 static void test_chunk();
 static void repl();
 static void run_file(const char* path);
-static char* read_file(const char* path);
+static int run_path(VM* vm, const char* path);
+static int run_batch(const char** paths, int path_count, int jobs, NumberFormat number_format);
+static bool read_manifest(const char* manifest, const char*** paths, int* count, int* capacity);
+static void add_path(const char*** paths, int* count, int* capacity, const char* path);
+static void free_paths(const char** paths, int count);
+static double seconds_since(struct timespec* start);
+static void bench_scanner();
+static void bench_output();
+static void bench_threads();
+static void bench_script();
+static void bench_serve(const char* self);
+static void stress_nesting();
+
+static VM vm;
+static bool mem_stats = false;
+static bool compile_only = false;
+
+static void print_gc_report() {
+    print_gc_stats(&vm);
+}
+
+static void print_opt_report() {
+    print_opt_stats(&vm.opt_stats);
+}
+
+static void flush_program_output() {
+    flush_output(&vm.output);
+}
+
+#ifdef QUICKEN_STATS
+static void print_quicken_report() {
+    print_quicken_stats(&vm.quicken_stats);
+}
+#endif
+
+#ifdef PROFILE_OPCODES
+static void print_profile_report() {
+    print_opcode_profile(&vm.profile);
+}
+#endif
 
 int main(int argc, char** argv) {
     // print_args(argc, argv);
     // test_chunk();
 
-    if (argc == 1) {
+    bool gc_stats = false;
+    bool opt_stats = false;
+    bool shortest_numbers = false;
+    bool batch = false;
+    bool serve = false;
+    const char* socket_path = NULL;
+    int jobs = 0;
+    const char** paths = NULL;
+    int path_count = 0;
+    int path_capacity = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--gc-stats") == 0) {
+            gc_stats = true;
+        } else if (strcmp(argv[i], "--opt-stats") == 0) {
+            opt_stats = true;
+        } else if (strcmp(argv[i], "--mem-stats") == 0) {
+            mem_stats = true;
+        } else if (strcmp(argv[i], "--compile-only") == 0) {
+            compile_only = true;
+        } else if (strcmp(argv[i], "--shortest-numbers") == 0) {
+            shortest_numbers = true;
+        } else if (strcmp(argv[i], "--bench-scanner") == 0) {
+            bench_scanner();
+            exit(0);
+        } else if (strcmp(argv[i], "--bench-output") == 0) {
+            bench_output();
+            exit(0);
+        } else if (strcmp(argv[i], "--bench-threads") == 0) {
+            bench_threads();
+            exit(0);
+        } else if (strcmp(argv[i], "--bench-script") == 0) {
+            bench_script();
+            exit(0);
+        } else if (strcmp(argv[i], "--bench-serve") == 0) {
+            bench_serve(argv[0]);
+            exit(0);
+        } else if (strcmp(argv[i], "--stress-nesting") == 0) {
+            stress_nesting();
+            exit(0);
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            serve = true;
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            serve = true;
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            batch = true;
+            if (!read_manifest(argv[++i], &paths, &path_count, &path_capacity)) {
+                fprintf(stderr, "Could not open file \"%s\".\n", argv[i]);
+                exit(74);
+            }
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            jobs = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "--", 2) != 0) {
+            add_path(&paths, &path_count, &path_capacity, argv[i]);
+        } else {
+            path_count = -1;
+            break;
+        }
+    }
+    if (path_count < 0 || (!batch && path_count > 1) || (batch && path_count == 0) || (serve && (batch || path_count > 0))) {
+        fprintf(stderr, "Usage: clox [--gc-stats] [--mem-stats] [--opt-stats] [--compile-only] [--shortest-numbers] "
+                        "[--bench-scanner] [--bench-output] [--bench-threads] [--bench-script] [--bench-serve] "
+                        "[--stress-nesting] [path]\n"
+                        "       clox --batch [--jobs n] [--manifest file] [--compile-only] [--shortest-numbers] "
+                        "[path...]\n"
+                        "       clox --serve [--socket path] [--shortest-numbers]\n");
+        exit(64);
+    }
+    if (batch && (gc_stats || opt_stats || mem_stats)) {
+        // each worker has a VM of its own and there's no single heap to report on
+        fprintf(stderr, "--gc-stats, --mem-stats and --opt-stats don't apply to --batch.\n");
+        exit(64);
+    }
+    if (compile_only && path_count == 0) {
+        fprintf(stderr, "--compile-only needs a path.\n");
+        exit(64);
+    }
+    NumberFormat number_format = shortest_numbers ? NUMBER_FORMAT_SHORTEST : NUMBER_FORMAT_G;
+    if (batch) {
+        if (jobs == 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            jobs = cpus > 0 ? (int)cpus : 1;
+        }
+        int status = run_batch(paths, path_count, jobs, number_format);
+        free_paths(paths, path_count);
+        exit(status);
+    }
+
+    init_vm(&vm);
+    vm.output.number_format = number_format;
+    atexit(flush_program_output);   // run_file() exits directly on errors
+    if (gc_stats) {
+        atexit(print_gc_report);     // run_file() exits directly on errors
+    }
+    if (opt_stats) {
+        atexit(print_opt_report);
+    }
+#ifdef QUICKEN_STATS
+    atexit(print_quicken_report);
+#endif
+#ifdef PROFILE_OPCODES
+    atexit(print_profile_report);
+#endif
+
+    if (serve) {
+        int status;
+        if (socket_path != NULL) {
+            status = serve_socket(&vm, socket_path);
+        } else {
+            signal(SIGPIPE, SIG_IGN);   // a client that stops reading ends the session instead of the process
+            status = serve_stream(&vm, STDIN_FILENO, STDOUT_FILENO) ? 0 : 74;
+        }
+        free_vm(&vm);
+        free_paths(paths, path_count);
+        return status;
+    }
+
+    if (path_count == 0) {
         repl();
-    } else if (argc == 2) {
-        run_file(argv[1]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        run_file(paths[0]);
     }
 
+    free_vm(&vm);
+    free_paths(paths, path_count);
     return EXIT_SUCCESS;
 }
 
 static void repl() {
     char line[1024];
     for (;;) {
+        flush_output(&vm.output);
         printf("> ");
 
         if (!fgets(line, sizeof(line), stdin)) {
@@ -43,73 +219,931 @@ static void repl() {
             break;
         }
 
-        interpret(line);
+        interpret(&vm, line);
+        if (mem_stats) {
+            print_mem_stats(&vm);
+        }
     }
 }
 
+// path.loxc is used instead of compiling when it was built from exactly this source
 static void run_file(const char* path) {
-    char* src = read_file(path);
-    InterpretResult result = interpret(src);
-    free(src);
+    int status = run_path(&vm, path);
+    if (mem_stats) {
+        print_mem_stats(&vm);
+    }
+    if (status != 0) {
+        exit(status);
+    }
+}
+
+// runs (or with --compile-only, compiles) one file on vm and returns the exit status clox gives for it alone
+static int run_path(VM* vm, const char* path) {
+    ObjSource* source = map_source(vm, path);
+    if (source == NULL) {
+        fprintf(vm->errors, "Could not open file \"%s\".\n", path);
+        return 74;
+    }
+    uint64_t source_hash = hash_source(source->chars, source->length);
+    char* cache_path = cache_path_for(path);
+
+    // the chunk keeps the source alive (and reachable) for as long as its borrowed string constants need it
+    Chunk chunk;
+    init_chunk(&chunk);
+    chunk.source = source;
+
+    int status = 0;
+    InterpretResult result;
+    if (compile_only) {
+        result = compile_chunk(vm, source->chars, &chunk);
+        if (result == INTERPRET_OK && !write_chunk_cache(&chunk, source_hash, cache_path)) {
+            fprintf(vm->errors, "Could not write \"%s\".\n", cache_path);
+            status = 74;
+        }
+    } else if (load_chunk_cache(vm, cache_path, source_hash, &chunk)) {
+        if (vm->listings) {
+            flush_output(&vm->output);
+            disassemble_chunk(&chunk, "Cached Chunk");
+        }
+        result = interpret_chunk(vm, &chunk);
+    } else {
+        result = compile_chunk(vm, source->chars, &chunk);
+        if (result == INTERPRET_OK) {
+            result = interpret_chunk(vm, &chunk);
+        }
+    }
+    free_chunk(vm, &chunk);
+    free(cache_path);
 
     switch (result) {
-        case INTERPRET_COMPILE_ERR: exit(65);
-        case INTERPRET_RUNTIME_ERR: exit(70);
+        case INTERPRET_COMPILE_ERR: return 65;
+        case INTERPRET_RUNTIME_ERR: return 70;
+        default: return status;
     }
 }
 
-static char* read_file(const char* path) {
-    FILE* file = fopen(path, "rb");
+typedef struct {
+    const char* path;
+    char* output;   // what the file printed, and what it reported on vm->errors
+    size_t output_size;
+    char* errors;
+    size_t errors_size;
+    int status;
+    double seconds;
+    bool done;
+} BatchFile;
+
+// one worker's share of the files. The owner takes from the front and thieves from the back: files are dealt
+// out round-robin, so owners working front to back finish them roughly in the order they're printed.
+typedef struct {
+    pthread_mutex_t lock;
+    int* files;
+    int head;
+    int tail;
+} BatchQueue;
+
+typedef struct Batch Batch;
+
+typedef struct {
+    pthread_t thread;
+    Batch* batch;
+    int index;
+    BatchQueue queue;
+} BatchWorker;
+
+struct Batch {
+    BatchFile* files;
+    int file_count;
+    BatchWorker* workers;
+    int worker_count;
+    NumberFormat number_format;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done;
+    // the workers' build-time reports, added up as each one finishes (under done_lock)
+#ifdef QUICKEN_STATS
+    QuickenStats quicken_stats;
+#endif
+#ifdef PROFILE_OPCODES
+    OpcodeProfile profile;
+#endif
+};
+
+// the next file for worker index: its own, or else one stolen from the first other queue that has any left
+static bool take_batch_file(Batch* batch, int index, int* file) {
+    for (int i = 0; i < batch->worker_count; ++i) {
+        BatchQueue* queue = &batch->workers[(index + i) % batch->worker_count].queue;
+        pthread_mutex_lock(&queue->lock);
+        bool found = queue->head < queue->tail;
+        if (found) {
+            *file = i == 0 ? queue->files[queue->head++] : queue->files[--queue->tail];
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (found) {
+            return true;
+        }
+    }
+    return false;     // nothing is ever queued once the workers start, so every queue is empty for good
+}
+
+static void* batch_worker_run(void* arg) {
+    BatchWorker* worker = arg;
+    Batch* batch = worker->batch;
+    VM* worker_vm = malloc(sizeof(VM));
+    if (worker_vm == NULL) {
+        exit(1);
+    }
+    init_vm(worker_vm);
+    worker_vm->listings = false;
+
+    int index;
+    while (take_batch_file(batch, worker->index, &index)) {
+        BatchFile* file = &batch->files[index];
+        FILE* output = open_memstream(&file->output, &file->output_size);
+        FILE* errors = open_memstream(&file->errors, &file->errors_size);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (output == NULL || errors == NULL) {
+            file->status = 74;
+        } else {
+            init_output(&worker_vm->output, output);
+            worker_vm->output.number_format = batch->number_format;
+            worker_vm->errors = errors;
+            file->status = run_path(worker_vm, file->path);
+            flush_output(&worker_vm->output);
+        }
+        file->seconds = seconds_since(&start);
+        if (output != NULL) {
+            fclose(output);
+        }
+        if (errors != NULL) {
+            fclose(errors);
+        }
+
+        pthread_mutex_lock(&batch->done_lock);
+        file->done = true;
+        pthread_cond_broadcast(&batch->done);
+        pthread_mutex_unlock(&batch->done_lock);
+    }
+
+#if defined(QUICKEN_STATS) || defined(PROFILE_OPCODES)
+    pthread_mutex_lock(&batch->done_lock);
+#ifdef QUICKEN_STATS
+    add_quicken_stats(&batch->quicken_stats, &worker_vm->quicken_stats);
+#endif
+#ifdef PROFILE_OPCODES
+    add_opcode_profile(&batch->profile, &worker_vm->profile);
+#endif
+    pthread_mutex_unlock(&batch->done_lock);
+#endif
+
+    init_output(&worker_vm->output, stdout);
+    worker_vm->errors = stderr;
+    free_vm(worker_vm);
+    free(worker_vm);
+    return NULL;
+}
+
+// runs every file on a pool of workers, each with a VM of its own, and prints each file's output (stdout) and
+// errors plus a timing line (stderr) in the order the files were given. Returns the exit status of the first
+// file that failed, or 0.
+static int run_batch(const char** paths, int path_count, int jobs, NumberFormat number_format) {
+    Batch batch;
+    batch.files = calloc(path_count, sizeof(BatchFile));
+    batch.file_count = path_count;
+    batch.worker_count = jobs < path_count ? jobs : path_count;
+    batch.workers = malloc(sizeof(BatchWorker) * batch.worker_count);
+    if (batch.files == NULL || batch.workers == NULL) {
+        exit(1);
+    }
+    batch.number_format = number_format;
+    pthread_mutex_init(&batch.done_lock, NULL);
+    pthread_cond_init(&batch.done, NULL);
+#ifdef QUICKEN_STATS
+    batch.quicken_stats = (QuickenStats){0};
+#endif
+#ifdef PROFILE_OPCODES
+    batch.profile = (OpcodeProfile){0};
+#endif
+
+    for (int i = 0; i < batch.worker_count; ++i) {
+        BatchQueue* queue = &batch.workers[i].queue;
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->files = malloc(sizeof(int) * (path_count / batch.worker_count + 1));
+        if (queue->files == NULL) {
+            exit(1);
+        }
+        queue->head = 0;
+        queue->tail = 0;
+    }
+    for (int i = 0; i < path_count; ++i) {
+        batch.files[i].path = paths[i];
+        BatchQueue* queue = &batch.workers[i % batch.worker_count].queue;
+        queue->files[queue->tail++] = i;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < batch.worker_count; ++i) {
+        batch.workers[i].batch = &batch;
+        batch.workers[i].index = i;
+        if (pthread_create(&batch.workers[i].thread, NULL, batch_worker_run, &batch.workers[i]) != 0) {
+            fprintf(stderr, "Could not start worker %d.\n", i);
+            exit(70);
+        }
+    }
+
+    int status = 0;
+    int failed = 0;
+    for (int i = 0; i < path_count; ++i) {
+        BatchFile* file = &batch.files[i];
+        pthread_mutex_lock(&batch.done_lock);
+        while (!file->done) {
+            pthread_cond_wait(&batch.done, &batch.done_lock);
+        }
+        pthread_mutex_unlock(&batch.done_lock);
+
+        fwrite(file->output, 1, file->output_size, stdout);
+        fflush(stdout);
+        fwrite(file->errors, 1, file->errors_size, stderr);
+        fprintf(stderr, "[batch] %s: exit %d, %.3f ms\n", file->path, file->status, file->seconds * 1e3);
+        free(file->output);
+        free(file->errors);
+        if (file->status != 0) {
+            ++failed;
+            if (status == 0) {
+                status = file->status;
+            }
+        }
+    }
+
+    for (int i = 0; i < batch.worker_count; ++i) {
+        pthread_join(batch.workers[i].thread, NULL);
+        pthread_mutex_destroy(&batch.workers[i].queue.lock);
+        free(batch.workers[i].queue.files);
+    }
+    double seconds = seconds_since(&start);
+    fprintf(stderr, "[batch] %d files, %d failed, %d workers: %.3f s, %.1f files/s\n",
+            path_count, failed, batch.worker_count, seconds, path_count / seconds);
+#ifdef QUICKEN_STATS
+    print_quicken_stats(&batch.quicken_stats);
+#endif
+#ifdef PROFILE_OPCODES
+    print_opcode_profile(&batch.profile);
+#endif
+
+    pthread_cond_destroy(&batch.done);
+    pthread_mutex_destroy(&batch.done_lock);
+    free(batch.workers);
+    free(batch.files);
+    return status;
+}
+
+// one path per line; blank lines are skipped. The lines are appended to paths, which grows as needed.
+static bool read_manifest(const char* manifest, const char*** paths, int* count, int* capacity) {
+    FILE* file = fopen(manifest, "r");
     if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, file)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+        add_path(paths, count, capacity, line);
+    }
+    free(line);
+    fclose(file);
+    return true;
+}
+
+// appends a copy of path, so every entry is freed the same way whether it came from argv or a manifest
+static void add_path(const char*** paths, int* count, int* capacity, const char* path) {
+    if (*count == *capacity) {
+        *capacity = GROW_CAPACITY(*capacity);
+        *paths = realloc(*paths, sizeof(const char*) * *capacity);
+    }
+    char* copy = *paths == NULL ? NULL : strdup(path);
+    if (copy == NULL) {
+        exit(1);
+    }
+    (*paths)[(*count)++] = copy;
+}
+
+static void free_paths(const char** paths, int count) {
+    for (int i = 0; i < count; ++i) {
+        free((char*)paths[i]);
+    }
+    free(paths);
+}
+
+#define BENCH_CORPUS_SIZE (32 << 20)
+#define BENCH_RUNS 5
+
+static const char* bench_code_lines[] = {
+    "    var total_%u = count_%u * %u.%u + (offset - %u);\n",
+    "    print \"processed record %u of the batch, status ok\" + label_%u;\n",
+    "    // keep the %u running sums separate so rounding doesn't drift across %u batches\n",
+    "\n",
+    "        if (index_%u <= limit and !done_%u) { return lookup(table, %u); }\n",
+    "fun compute_%u(left, right) {\n",
+    "    }\n",
+    "            while (i < %u) { i = i + 1; sum = sum + values_%u[i] / %u; }\n",
+    NULL,
+};
+
+static const char* bench_data_lines[] = {
+    "    \"row %u: the quick brown fox jumps over the lazy dog, then does it %u more times for good measure\" +\n",
+    "    // generated from fixture %u; regenerate with the export script rather than editing these %u rows by hand\n",
+    "    \"%u,%u,%u,alpha,bravo,charlie,delta,echo,foxtrot,golf,hotel,india,juliet,kilo,lima,mike\" +\n",
+    NULL,
+};
+
+// scans a synthetic corpus built from lines (printf formats taking up to five numbers) and prints its throughput
+static void bench_corpus(const char* name, const char** lines) {
+    int line_kinds = 0;
+    while (lines[line_kinds] != NULL) {
+        ++line_kinds;
+    }
+
+    char* corpus = malloc(BENCH_CORPUS_SIZE + 256);
+    size_t size = 0;
+    uint32_t seed = 12345;
+    while (size < BENCH_CORPUS_SIZE) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t n = seed >> 8;
+        size += sprintf(corpus + size, lines[(seed >> 16) % line_kinds], n % 997, n % 89, n % 1000, n % 10, n % 7);
+    }
+
+    double best = 0;
+    long tokens = 0;
+    for (int run = 0; run < BENCH_RUNS; ++run) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        Scanner scanner;
+        init_scanner(&scanner, corpus);
+        tokens = 0;
+        while (scan_token(&scanner).type != TOKEN_EOF) {
+            ++tokens;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (run == 0 || seconds < best) {
+            best = seconds;
+        }
     }
 
-    fseek(file, 0L, SEEK_END);
-    size_t file_size = ftell(file);
-    rewind(file);
+    printf("%-5s %.1f MB, %ld tokens: best of %d %.3f s, %.1f MB/s, %.1f M tokens/s\n",
+           name, size / 1e6, tokens, BENCH_RUNS, best, size / 1e6 / best, tokens / 1e6 / best);
+    free(corpus);
+}
+
+// scanner throughput: "code" is Lox-looking source with the usual mix of short tokens, "data" is mostly long
+// string literals and comments
+static void bench_scanner() {
+    bench_corpus("code", bench_code_lines);
+    bench_corpus("data", bench_data_lines);
+}
+
+#define BENCH_VALUES (1 << 21)
+
+static const char* bench_strings[] = {"ok", "processed record", "the quick brown fox jumps over the lazy dog", ""};
+
+static double seconds_since(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
 
-    char* buffer = (char*)malloc(file_size + 1);
-    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
-    buffer[bytes_read] = '\0';
-    if (bytes_read < file_size) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
+// print throughput, writing to /dev/null: the printf-per-value path print used to take against the output buffer,
+// for a mix of short integers, two-place decimals, arbitrary doubles, strings and booleans
+static void bench_output() {
+    init_vm(&vm);
+    FILE* sink = fopen("/dev/null", "w");
+    if (sink == NULL) {
+        fprintf(stderr, "Could not open /dev/null.\n");
         exit(74);
     }
 
+    // interned strings on the stack so building the rest can't collect them
+    int string_count = sizeof(bench_strings) / sizeof(bench_strings[0]);
+    for (int i = 0; i < string_count; ++i) {
+        push(&vm, OBJ_VAL(copy_string(&vm, bench_strings[i], (int)strlen(bench_strings[i]))));
+    }
+    Value* values = malloc(sizeof(Value) * BENCH_VALUES);
+    uint32_t seed = 12345;
+    for (int i = 0; i < BENCH_VALUES; ++i) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t n = seed >> 8;
+        switch ((seed >> 4) % 8) {
+            case 0:
+            case 1: values[i] = NUMBER_VAL(n % 100000); break;
+            case 2:
+            case 3: values[i] = NUMBER_VAL((n % 1000000) / 100.0); break;
+            case 4: values[i] = NUMBER_VAL((double)n / (seed | 1) * 1e6); break;
+            case 5: values[i] = NUMBER_VAL(1.0 / (n | 1)); break;
+            case 6: values[i] = vm.stack[n % string_count]; break;
+            default: values[i] = BOOL_VAL(n & 1); break;
+        }
+    }
+
+    const char* names[] = {"printf", "buffered %g", "buffered shortest"};
+    for (int mode = 0; mode < 3; ++mode) {
+        double best = 0;
+        for (int run = 0; run < BENCH_RUNS; ++run) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (mode == 0) {
+                for (int i = 0; i < BENCH_VALUES; ++i) {
+                    Value value = values[i];
+                    if (IS_NUMBER(value)) {
+                        fprintf(sink, "%g", AS_NUMBER(value));
+                    } else if (IS_BOOL(value)) {
+                        fprintf(sink, AS_BOOL(value) ? "true" : "false");
+                    } else {
+                        fprintf(sink, "%.*s", AS_STRING(value)->length, AS_STRING(value)->chars);
+                    }
+                    fprintf(sink, "\n");
+                }
+                fflush(sink);
+            } else {
+                Output* output = malloc(sizeof(Output));
+                init_output(output, sink);
+                output->number_format = mode == 1 ? NUMBER_FORMAT_G : NUMBER_FORMAT_SHORTEST;
+                for (int i = 0; i < BENCH_VALUES; ++i) {
+                    write_value(output, values[i]);
+                    write_output(output, "\n", 1);
+                }
+                flush_output(output);
+                fflush(sink);
+                free(output);
+            }
+            double seconds = seconds_since(&start);
+            if (run == 0 || seconds < best) {
+                best = seconds;
+            }
+        }
+        printf("%-17s %d values: best of %d %.3f s, %.1f M values/s\n",
+               names[mode], BENCH_VALUES, BENCH_RUNS, best, BENCH_VALUES / 1e6 / best);
+    }
+
+    free(values);
+    fclose(sink);
+    free_vm(&vm);
+}
+
+#define BENCH_PROGRAMS (1 << 16)
+#define BENCH_MAX_THREADS 64
+
+static const char* bench_program_formats[] = {
+    "(\"record \" + \"%u\") + \" of \" + \"%u\" + \", status \" + \"ok-%u\"",
+    "(%u.25 * 3 - %u) / (7 + %u) > 2 == !false",
+    "-(%u + %u * (%u - 0.5)) / 1000",
+    "\"%u\" + \"-\" + \"%u\" == \"%u-%u\"",
+    NULL,
+};
+
+typedef struct {
+    pthread_t thread;
+    char** programs;
+    char* output;
+    size_t output_size;
+    bool ok;
+} BenchThread;
+
+// compiles and runs every program on a VM of its own, collecting what they print
+static void* bench_thread_run(void* arg) {
+    BenchThread* bench = arg;
+    FILE* file = open_memstream(&bench->output, &bench->output_size);
+    VM* thread_vm = malloc(sizeof(VM));
+    bench->ok = file != NULL && thread_vm != NULL;
+    if (!bench->ok) {
+        free(thread_vm);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return NULL;
+    }
+
+    init_vm(thread_vm);
+    init_output(&thread_vm->output, file);
+    thread_vm->listings = false;
+    for (int i = 0; i < BENCH_PROGRAMS; ++i) {
+        bench->ok = interpret(thread_vm, bench->programs[i]) == INTERPRET_OK && bench->ok;
+    }
+    free_vm(thread_vm);
+    free(thread_vm);
     fclose(file);
-    return buffer;
+    return NULL;
+}
+
+// runs the same batch of string-building and arithmetic programs on 1, 2, 4, ... threads, each with its own VM,
+// checks every thread printed exactly what a lone thread did, and reports throughput against the lone thread
+static void bench_threads() {
+    char** programs = malloc(sizeof(char*) * BENCH_PROGRAMS);
+    int format_count = sizeof(bench_program_formats) / sizeof(bench_program_formats[0]) - 1;
+    uint32_t seed = 12345;
+    for (int i = 0; i < BENCH_PROGRAMS; ++i) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t n = seed >> 8;
+        programs[i] = malloc(256);
+        snprintf(programs[i], 256, bench_program_formats[i % format_count], n % 997, n % 89, n % 1000, n % 89);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = cpus > 4 ? (int)cpus : 4;    // always some contention, even on a single core
+    if (max_threads > BENCH_MAX_THREADS) {
+        max_threads = BENCH_MAX_THREADS;
+    }
+    printf("%ld cpus, %d programs per thread\n", cpus, BENCH_PROGRAMS);
+
+    BenchThread* benches = malloc(sizeof(BenchThread) * max_threads);
+    char* reference = NULL;
+    size_t reference_size = 0;
+    double base_rate = 0;
+    bool all_ok = true;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < threads; ++i) {
+            benches[i].programs = programs;
+            benches[i].output = NULL;
+            benches[i].output_size = 0;
+            if (pthread_create(&benches[i].thread, NULL, bench_thread_run, &benches[i]) != 0) {
+                fprintf(stderr, "Could not start thread %d.\n", i);
+                exit(70);
+            }
+        }
+        for (int i = 0; i < threads; ++i) {
+            pthread_join(benches[i].thread, NULL);
+        }
+        double seconds = seconds_since(&start);
+
+        int mismatches = 0;
+        for (int i = 0; i < threads; ++i) {
+            if (reference == NULL) {
+                reference = benches[i].output;
+                reference_size = benches[i].output_size;
+                benches[i].output = NULL;
+            } else if (benches[i].output_size != reference_size ||
+                       memcmp(benches[i].output, reference, reference_size) != 0) {
+                ++mismatches;
+            }
+            mismatches += !benches[i].ok;
+            free(benches[i].output);
+        }
+        all_ok = all_ok && mismatches == 0;
+
+        double rate = threads * (double)BENCH_PROGRAMS / seconds;
+        if (threads == 1) {
+            base_rate = rate;
+        }
+        printf("%2d threads: %.3f s, %.0f programs/s, %.2fx, %s\n", threads, seconds, rate, rate / base_rate,
+               mismatches == 0 ? "outputs match" : "OUTPUTS DIFFER");
+    }
+
+    free(reference);
+    free(benches);
+    for (int i = 0; i < BENCH_PROGRAMS; ++i) {
+        free(programs[i]);
+    }
+    free(programs);
+    if (!all_ok) {
+        exit(70);
+    }
+}
+
+#define BENCH_SCRIPT_RUNS 200000
+
+// one expression evaluated per record, the way a host would without run_script(): spliced into the source and
+// interpreted from scratch every time, against compiling it once and passing the record in as inputs
+static void bench_script() {
+    init_vm(&vm);
+    vm.listings = false;
+    FILE* sink = fopen("/dev/null", "w");
+    if (sink == NULL) {
+        fprintf(stderr, "Could not open /dev/null.\n");
+        exit(74);
+    }
+    init_output(&vm.output, sink);
+
+    const char* script_source = "($0 * 1.5 + $1) / 4 > 100 == (\"row-\" + $2 == \"row-7\")";
+    const char* spliced_format = "(%d * 1.5 + %d) / 4 > 100 == (\"row-\" + \"%d\" == \"row-7\")";
+    Script* script = compile_script(script_source);
+    if (script == NULL) {
+        exit(65);
+    }
+
+    bool* expected = malloc(sizeof(bool) * BENCH_SCRIPT_RUNS);
+    double best[2] = {0, 0};
+    int mismatches = 0;
+    for (int run = 0; run < BENCH_RUNS; ++run) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCH_SCRIPT_RUNS; ++i) {
+            char source[128];
+            snprintf(source, sizeof(source), spliced_format, i % 1000, i % 37, i % 10);
+            if (interpret(&vm, source) != INTERPRET_OK) {
+                exit(70);
+            }
+            expected[i] = AS_BOOL(vm.result);
+        }
+        double seconds = seconds_since(&start);
+        if (run == 0 || seconds < best[0]) {
+            best[0] = seconds;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCH_SCRIPT_RUNS; ++i) {
+            char label[16];
+            int length = snprintf(label, sizeof(label), "%d", i % 10);
+            Value inputs[] = {NUMBER_VAL(i % 1000), NUMBER_VAL(i % 37), OBJ_VAL(copy_string(&vm, label, length))};
+            Value result;
+            if (run_script(&vm, script, inputs, 3, &result) != INTERPRET_OK) {
+                exit(70);
+            }
+            mismatches += AS_BOOL(result) != expected[i];
+        }
+        seconds = seconds_since(&start);
+        if (run == 0 || seconds < best[1]) {
+            best[1] = seconds;
+        }
+    }
+
+    const char* names[] = {"interpret()", "run_script()"};
+    for (int mode = 0; mode < 2; ++mode) {
+        printf("%-12s %d runs: best of %d %.3f s, %.0f runs/s\n",
+               names[mode], BENCH_SCRIPT_RUNS, BENCH_RUNS, best[mode], BENCH_SCRIPT_RUNS / best[mode]);
+    }
+    printf("%.1fx, %s\n", best[0] / best[1], mismatches == 0 ? "results match" : "RESULTS DIFFER");
+
+    free(expected);
+    free_script(script);
+#ifdef PROFILE_OPCODES
+    print_opcode_profile(&vm.profile);
+#endif
+    free_vm(&vm);
+    fclose(sink);
+    if (mismatches != 0) {
+        exit(70);
+    }
+}
+
+#define BENCH_REQUESTS 20000
+#define BENCH_SPAWNS 200
+
+static void* bench_server_run(void* arg) {
+    int fd = *(int*)arg;
+    VM* server_vm = malloc(sizeof(VM));
+    init_vm(server_vm);
+    serve_stream(server_vm, fd, fd);
+    free_vm(server_vm);
+    free(server_vm);
+    return NULL;
+}
+
+static bool bench_io(int fd, char* buffer, size_t size, bool writing) {
+    while (size > 0) {
+        ssize_t done = writing ? write(fd, buffer, size) : read(fd, buffer, size);
+        if (done <= 0) {
+            return false;
+        }
+        buffer += done;
+        size -= (size_t)done;
+    }
+    return true;
+}
+
+// one --serve request and its response; the response's output goes into output (of size capacity)
+static uint32_t bench_request(int fd, const char* source, char* output, size_t capacity) {
+    uint32_t length = (uint32_t)strlen(source);
+    uint8_t header[12] = {length, length >> 8, length >> 16, length >> 24};
+    if (!bench_io(fd, (char*)header, 4, true) || !bench_io(fd, (char*)source, length, true) ||
+        !bench_io(fd, (char*)header, 12, false)) {
+        return UINT32_MAX;
+    }
+    uint32_t status = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+    uint32_t output_size = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+    uint32_t errors_size = header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24);
+    if (output_size + errors_size >= capacity || !bench_io(fd, output, output_size + errors_size, false)) {
+        return UINT32_MAX;
+    }
+    output[output_size] = '\0';
+    return status;
+}
+
+// the cost of one evaluation: a request to a warm --serve session over a socket, against spawning clox on a file
+// holding the same script and waiting for it to exit
+static void bench_serve(const char* self) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        fprintf(stderr, "Could not create a socket pair.\n");
+        exit(74);
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, bench_server_run, &fds[1]);
+
+    char source[128];
+    char output[256];
+    int failures = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_REQUESTS; ++i) {
+        snprintf(source, sizeof(source), "\"record \" + \"%d\" == \"record %d\"", i % 100, i % 50);
+        bool expected = i % 100 == i % 50;
+        failures += bench_request(fds[0], source, output, sizeof(output)) != 0 ||
+                    strcmp(output, expected ? "true\n" : "false\n") != 0;
+    }
+    double serve_seconds = seconds_since(&start);
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(server, NULL);
+    close(fds[0]);
+    close(fds[1]);
+
+    char path[] = "/tmp/clox-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, source, strlen(source)) != (ssize_t)strlen(source)) {
+        fprintf(stderr, "Could not write a temporary script.\n");
+        exit(74);
+    }
+    close(fd);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    char* spawn_argv[] = {(char*)self, path, NULL};
+    extern char** environ;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_SPAWNS; ++i) {
+        pid_t pid;
+        int status;
+        if (posix_spawnp(&pid, self, &actions, NULL, spawn_argv, environ) != 0 || waitpid(pid, &status, 0) != pid ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ++failures;
+        }
+    }
+    double spawn_seconds = seconds_since(&start);
+    posix_spawn_file_actions_destroy(&actions);
+    unlink(path);
+
+    double serve_us = serve_seconds / BENCH_REQUESTS * 1e6;
+    double spawn_us = spawn_seconds / BENCH_SPAWNS * 1e6;
+    printf("--serve requests %6d: %.3f s, %8.1f us each\n", BENCH_REQUESTS, serve_seconds, serve_us);
+    printf("process per run  %6d: %.3f s, %8.1f us each\n", BENCH_SPAWNS, spawn_seconds, spawn_us);
+    printf("%.0fx, %s\n", spawn_us / serve_us, failures == 0 ? "all results ok" : "FAILURES");
+    if (failures != 0) {
+        exit(70);
+    }
+}
+
+// a sixteenth of the usual 8 MB main thread stack, the sort a host running clox on its own threads might give; an
+// ASan build needs over 256 KB for MAX_NESTING levels, -O2 about 180 KB
+#define STRESS_STACK_SIZE (512 * 1024)
+
+typedef struct {
+    const char* name;
+    const char* prefix;     // repeated once per repetition
+    const char* innermost;
+    const char* suffix;     // repeated once per repetition, after innermost
+    int levels;             // parser levels each repetition takes
+    bool flips;             // each repetition negates the value
+} NestingShape;
+
+static const NestingShape nesting_shapes[] = {
+    {"grouping", "(", "1", ")", 1, false},
+    {"negation", "-", "1", "", 1, true},
+    {"not", "!", "true", "", 1, true},
+    {"negated grouping", "-(", "1", ")", 2, true},
+};
+
+typedef struct {
+    bool ok;
+} NestingStress;
+
+static char* nested_source(const NestingShape* shape, int repeats) {
+    size_t prefix_length = strlen(shape->prefix);
+    size_t suffix_length = strlen(shape->suffix);
+    size_t innermost_length = strlen(shape->innermost);
+    char* source = malloc((prefix_length + suffix_length) * repeats + innermost_length + 1);
+    char* p = source;
+    for (int i = 0; i < repeats; ++i, p += prefix_length) {
+        memcpy(p, shape->prefix, prefix_length);
+    }
+    memcpy(p, shape->innermost, innermost_length);
+    p += innermost_length;
+    for (int i = 0; i < repeats; ++i, p += suffix_length) {
+        memcpy(p, shape->suffix, suffix_length);
+    }
+    *p = '\0';
+    return source;
+}
+
+static Value nested_value(const NestingShape* shape, int repeats) {
+    bool flipped = shape->flips && repeats % 2 == 1;
+    if (strcmp(shape->innermost, "true") == 0) {
+        return BOOL_VAL(!flipped);
+    }
+    return NUMBER_VAL(flipped ? -1 : 1);
+}
+
+static void* stress_nesting_run(void* arg) {
+    NestingStress* stress = arg;
+    VM* thread_vm = malloc(sizeof(VM));
+    FILE* sink = fopen("/dev/null", "w");
+    stress->ok = thread_vm != NULL && sink != NULL;
+    if (!stress->ok) {
+        free(thread_vm);
+        if (sink != NULL) {
+            fclose(sink);
+        }
+        return NULL;
+    }
+    init_vm(thread_vm);
+    init_output(&thread_vm->output, sink);
+    thread_vm->errors = sink;
+    thread_vm->listings = false;
+
+    int shape_count = sizeof(nesting_shapes) / sizeof(nesting_shapes[0]);
+    for (int i = 0; i < shape_count; ++i) {
+        const NestingShape* shape = &nesting_shapes[i];
+        // the whole expression is one level and its innermost operand is parsed one further down
+        int deepest = (MAX_NESTING - 1) / shape->levels;
+
+        // the deepest expression the parser accepts has to run and give the right answer; one more level has to
+        // be a compile error rather than a crash
+        char* source = nested_source(shape, deepest);
+        InterpretResult accepted = interpret(thread_vm, source);
+        bool correct = accepted == INTERPRET_OK && values_equal(thread_vm->result, nested_value(shape, deepest));
+        free(source);
+        source = nested_source(shape, deepest + 1);
+        InterpretResult rejected = interpret(thread_vm, source);
+        free(source);
+
+        printf("%-17s %5d deep: %-5s %5d deep: %s\n", shape->name, deepest, correct ? "ok" : "WRONG", deepest + 1,
+               rejected == INTERPRET_COMPILE_ERR ? "rejected" : "NOT REJECTED");
+        stress->ok = stress->ok && correct && rejected == INTERPRET_COMPILE_ERR;
+    }
+
+    free_vm(thread_vm);
+    free(thread_vm);
+    fclose(sink);
+    return NULL;
+}
+
+// generated expressions nested right up to MAX_NESTING and one level past it, compiled and run on a thread with a
+// deliberately small stack, so a cap too generous for the parser's recursion shows up as a crash here
+static void stress_nesting() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, STRESS_STACK_SIZE);
+    printf("MAX_NESTING %d, %d KB thread stack\n", MAX_NESTING, STRESS_STACK_SIZE / 1024);
+
+    NestingStress stress;
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, stress_nesting_run, &stress) != 0) {
+        fprintf(stderr, "Could not start thread.\n");
+        exit(70);
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (!stress.ok) {
+        exit(70);
+    }
 }
 
 static void test_chunk() {
-    init_vm();
+    init_vm(&vm);
 
     Chunk chunk;
     init_chunk(&chunk);
 
-    int new_const = add_constant(&chunk, NUMBER_VAL(5));
-    write_chunk(&chunk, OP_CONSTANT);
-    write_chunk(&chunk, new_const);
+    int new_const = add_constant(&vm, &chunk, NUMBER_VAL(5));
+    write_chunk(&vm, &chunk, OP_CONSTANT, 123);
+    write_chunk(&vm, &chunk, new_const, 123);
 
-    write_chunk(&chunk, OP_NEGATE);
+    write_chunk(&vm, &chunk, OP_NEGATE, 123);
 
-    int constant = add_constant(&chunk, NUMBER_VAL(3));
-    write_chunk(&chunk, OP_CONSTANT);
-    write_chunk(&chunk, constant);
+    int constant = add_constant(&vm, &chunk, NUMBER_VAL(3));
+    write_chunk(&vm, &chunk, OP_CONSTANT, 123);
+    write_chunk(&vm, &chunk, constant, 123);
 
-    write_chunk(&chunk, OP_ADD);
+    write_chunk(&vm, &chunk, OP_ADD, 123);
 
-    constant = add_constant(&chunk, NUMBER_VAL(10));
-    write_chunk(&chunk, OP_CONSTANT);
-    write_chunk(&chunk, constant);
+    constant = add_constant(&vm, &chunk, NUMBER_VAL(10));
+    write_chunk(&vm, &chunk, OP_CONSTANT, 123);
+    write_chunk(&vm, &chunk, constant, 123);
 
-    write_chunk(&chunk, OP_DIVIDE);
+    write_chunk(&vm, &chunk, OP_DIVIDE, 123);
 
-    write_chunk(&chunk, OP_RETURN);
+    write_chunk(&vm, &chunk, OP_RETURN, 123);
     disassemble_chunk(&chunk, "First Chunk");
-    // interpret(&chunk);
+    // interpret_chunk(&vm, &chunk);
 
-    free_vm();
-    free_chunk(&chunk);
+    free_vm(&vm);
+    free_chunk(&vm, &chunk);
 }
 
 static void print_args(int argc, char** argv) {
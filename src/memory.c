@@ -1,9 +1,113 @@
+// clock_gettime() and CLOCK_MONOTONIC are POSIX rather than C
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 
+#include "includes/compiler.h"
 #include "includes/memory.h"
+#include "includes/object.h"
+#include "includes/pool.h"
+#include "includes/table.h"
+#include "includes/vm.h"
+
+#ifdef DEBUG_LOG_GC
+#include "includes/debug.h"
+#endif
+
+static void mark_roots(VM* vm);
+static void mark_array(VM* vm, ValueArr* arr);
+static void trace_references(VM* vm);
+static void blacken_object(VM* vm, Obj* obj);
+static void sweep(VM* vm);
+static void free_object(VM* vm, Obj* obj);
+static double now_seconds();
+
+static void record_allocation(VM* vm, size_t old_size, size_t new_size, MemCategory category) {
+    MemStats* stats = &vm->mem_stats;
+    if (old_size == 0 && new_size == 0) {
+        return;     // freeing an array that never got any storage
+    }
+    if (old_size == 0) {
+        ++stats->allocations;
+    } else if (new_size == 0) {
+        ++stats->frees;
+    } else {
+        ++stats->reallocations;
+    }
+
+    if (vm->bytes_allocated > stats->peak_bytes) {
+        stats->peak_bytes = vm->bytes_allocated;
+    }
+    stats->category_bytes[category] += new_size - old_size;
+    if (stats->category_bytes[category] > stats->category_peak[category]) {
+        stats->category_peak[category] = stats->category_bytes[category];
+    }
+}
+
+#ifdef POOL_ALLOCATOR
+// blocks up to POOL_MAX_SIZE live in vm->pool, bigger ones in malloc; old_size tells us which one ptr came from
+static void* pool_reallocate(VM* vm, void* ptr, size_t old_size, size_t new_size) {
+    bool old_pooled = ptr != NULL && old_size <= POOL_MAX_SIZE;
+    bool new_pooled = new_size != 0 && new_size <= POOL_MAX_SIZE;
+
+    if (new_size == 0) {
+        if (old_pooled) {
+            pool_free(&vm->pool, ptr, old_size);
+        } else {
+            free(ptr);
+        }
+        return NULL;
+    }
+
+    if (!old_pooled && !new_pooled) {
+        void* result = realloc(ptr, new_size);
+        if (result == NULL) {
+            exit(1);
+        }
+        return result;
+    }
+
+    if (old_pooled && new_pooled && POOL_SIZE_CLASS(old_size) == POOL_SIZE_CLASS(new_size)) {
+        return ptr;
+    }
 
-void* reallocate(void* ptr, size_t old_size, size_t new_size) {
+    void* result = new_pooled ? pool_alloc(&vm->pool, new_size) : malloc(new_size);
+    if (result == NULL) {
+        exit(1);
+    }
+    if (ptr != NULL) {
+        memcpy(result, ptr, old_size < new_size ? old_size : new_size);
+        if (old_pooled) {
+            pool_free(&vm->pool, ptr, old_size);
+        } else {
+            free(ptr);
+        }
+    }
+    return result;
+}
+#endif
+
+void* reallocate(VM* vm, void* ptr, size_t old_size, size_t new_size, MemCategory category) {
+    vm->bytes_allocated += new_size - old_size;
+    record_allocation(vm, old_size, new_size, category);
+
+    if (new_size > old_size) {
+#ifdef DEBUG_STRESS_GC
+        collect_garbage(vm);
+#else
+        if (vm->bytes_allocated > vm->next_gc) {
+            collect_garbage(vm);
+        }
+#endif
+    }
+
+#ifdef POOL_ALLOCATOR
+    return pool_reallocate(vm, ptr, old_size, new_size);
+#else
     if (new_size == 0) {
         free(ptr);
         return NULL;
@@ -14,4 +118,200 @@ void* reallocate(void* ptr, size_t old_size, size_t new_size) {
         exit(1);
     }
     return result;
-}
\ No newline at end of file
+#endif
+}
+
+void mark_object(VM* vm, Obj* obj) {
+    if (obj == NULL || obj->is_marked) {
+        return;
+    }
+
+#ifdef DEBUG_LOG_GC
+    printf("%p mark ", (void*)obj);
+    print_value(OBJ_VAL(obj));
+    printf("\n");
+#endif
+
+    obj->is_marked = true;
+
+    // the gray stack is malloc'd directly so growing it can never re-enter the collector
+    if (vm->gray_capacity < vm->gray_count + 1) {
+        vm->gray_capacity = GROW_CAPACITY(vm->gray_capacity);
+        vm->gray_stack = (Obj**)realloc(vm->gray_stack, sizeof(Obj*) * vm->gray_capacity);
+        if (vm->gray_stack == NULL) {
+            exit(1);
+        }
+    }
+    vm->gray_stack[vm->gray_count] = obj;
+    ++vm->gray_count;
+}
+
+void mark_value(VM* vm, Value value) {
+    if (IS_OBJ(value)) {
+        mark_object(vm, AS_OBJ(value));
+    }
+}
+
+void collect_garbage(VM* vm) {
+    double start = now_seconds();
+    size_t before = vm->bytes_allocated;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+#endif
+
+    mark_roots(vm);
+    trace_references(vm);
+    table_remove_white(&vm->strings);    // the intern table holds its strings weakly
+    sweep(vm);
+
+    vm->next_gc = vm->bytes_allocated * GC_HEAP_GROW_FACTOR;
+    if (vm->next_gc < GC_INITIAL_THRESHOLD) {
+        vm->next_gc = GC_INITIAL_THRESHOLD;
+    }
+
+    double pause = now_seconds() - start;
+    ++vm->gc_stats.collections;
+    vm->gc_stats.bytes_freed += before - vm->bytes_allocated;
+    vm->gc_stats.total_pause += pause;
+    if (pause > vm->gc_stats.max_pause) {
+        vm->gc_stats.max_pause = pause;
+    }
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+           before - vm->bytes_allocated, before, vm->bytes_allocated, vm->next_gc);
+#endif
+}
+
+void free_objects(VM* vm) {
+    Obj* obj = vm->objects;
+    while (obj != NULL) {
+        Obj* next = obj->next;
+        free_object(vm, obj);
+        obj = next;
+    }
+    vm->objects = NULL;
+
+    free(vm->gray_stack);
+    vm->gray_stack = NULL;
+    vm->gray_count = 0;
+    vm->gray_capacity = 0;
+}
+
+void print_gc_stats(VM* vm) {
+    GCStats* stats = &vm->gc_stats;
+    fprintf(stderr, "== gc stats ==\n");
+    fprintf(stderr, "collections:     %d\n", stats->collections);
+    fprintf(stderr, "bytes freed:     %zu\n", stats->bytes_freed);
+    fprintf(stderr, "total pause:     %.3f ms\n", stats->total_pause * 1e3);
+    fprintf(stderr, "max pause:       %.3f ms\n", stats->max_pause * 1e3);
+    fprintf(stderr, "avg pause:       %.3f ms\n",
+            stats->collections == 0 ? 0.0 : stats->total_pause * 1e3 / stats->collections);
+    fprintf(stderr, "heap now:        %zu bytes (next gc at %zu)\n", vm->bytes_allocated, vm->next_gc);
+}
+
+void print_mem_stats(VM* vm) {
+    static const char* category_names[MEM_CATEGORY_COUNT] = {
+        [MEM_CHUNK_CODE] = "chunk code",
+        [MEM_LINES] = "line table",
+        [MEM_CONSTANTS] = "constants",
+        [MEM_OBJECTS] = "objects",
+        [MEM_TABLES] = "tables",
+        [MEM_STACK] = "vm stack",
+    };
+
+    MemStats* stats = &vm->mem_stats;
+    fprintf(stderr, "== mem stats ==\n");
+    fprintf(stderr, "current bytes:   %zu\n", vm->bytes_allocated);
+    fprintf(stderr, "peak bytes:      %zu\n", stats->peak_bytes);
+    fprintf(stderr, "allocations:     %zu (%zu resizes, %zu frees)\n",
+            stats->allocations, stats->reallocations, stats->frees);
+    fprintf(stderr, "%-16s %12s %12s\n", "category", "current", "peak");
+    for (int i = 0; i < MEM_CATEGORY_COUNT; ++i) {
+        fprintf(stderr, "%-16s %12zu %12zu\n", category_names[i], stats->category_bytes[i], stats->category_peak[i]);
+    }
+    fprintf(stderr, "live strings:    %zu (%zu header bytes, %zu char bytes)\n",
+            stats->string_count, stats->string_count * sizeof(ObjString), stats->string_bytes);
+}
+
+static void mark_roots(VM* vm) {
+    for (Value* slot = vm->stack; slot < vm->stack_top; ++slot) {
+        mark_value(vm, *slot);
+    }
+
+    if (vm->chunk != NULL) {
+        mark_array(vm, &vm->chunk->constants);
+        mark_object(vm, (Obj*)vm->chunk->source);
+    }
+    mark_compiler_roots(vm);
+}
+
+static void mark_array(VM* vm, ValueArr* arr) {
+    for (int i = 0; i < arr->count; ++i) {
+        mark_value(vm, arr->values[i]);
+    }
+}
+
+static void trace_references(VM* vm) {
+    while (vm->gray_count > 0) {
+        --vm->gray_count;
+        blacken_object(vm, vm->gray_stack[vm->gray_count]);
+    }
+}
+
+static void blacken_object(VM* vm, Obj* obj) {
+    switch (obj->type) {
+        case OBJ_STRING: {
+            mark_object(vm, (Obj*)((ObjString*)obj)->source);   // NULL unless borrowed
+            break;
+        }
+        case OBJ_SOURCE: break;
+    }
+}
+
+static void sweep(VM* vm) {
+    Obj* prev = NULL;
+    Obj* obj = vm->objects;
+    while (obj != NULL) {
+        if (obj->is_marked) {
+            obj->is_marked = false;
+            prev = obj;
+            obj = obj->next;
+            continue;
+        }
+
+        Obj* unreached = obj;
+        obj = obj->next;
+        if (prev != NULL) {
+            prev->next = obj;
+        } else {
+            vm->objects = obj;
+        }
+        free_object(vm, unreached);
+    }
+}
+
+static void free_object(VM* vm, Obj* obj) {
+#ifdef DEBUG_LOG_GC
+    printf("%p free type %d\n", (void*)obj, obj->type);
+#endif
+
+    switch (obj->type) {
+        case OBJ_STRING: {
+            free_string(vm, (ObjString*)obj);
+            break;
+        }
+        case OBJ_SOURCE: {
+            free_source(vm, (ObjSource*)obj);
+            break;
+        }
+    }
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,515 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "includes/number.h"
+
+// a uint64_t holds any 19 decimal digits; anything past that only nudges the value, see truncated below
+#define MAX_DIGITS 19
+#define MAX_EXACT_INT (1ull << 53)
+#define MAX_EXACT_POW10 22
+
+// Eisel-Lemire only covers the decimal exponents where the truncated 128-bit power of five can't leave the
+// rounding undecided; literals outside it (more than ~27 fractional digits, or huge integers) go to strtod
+#define MIN_LEMIRE_POW10 -27
+#define MAX_LEMIRE_POW10 55
+
+static bool clinger(uint64_t w, int q, double* out);
+static bool eisel_lemire(uint64_t w, int q, double* out);
+static double parse_fallback(const char* chars, int length);
+static int format_special(double value, char* buffer);
+static void to_decimal(double magnitude, int precision, uint64_t* digits, int* exponent);
+static bool lemire_decimal(double magnitude, int precision, uint64_t* digits, int* exponent);
+static bool round_trips(double magnitude, uint64_t digits, int q);
+static bool shortest_candidate(double magnitude, int precision, uint64_t* digits, int exponent);
+static int write_decimal(char* out, uint64_t digits, int count, int exponent, int max_fixed_exponent);
+
+static const double exact_pow10[MAX_EXACT_POW10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const uint64_t int_pow10[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull,
+    10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull, 100000000000000ull,
+    1000000000000000ull, 10000000000000000ull, 100000000000000000ull, 1000000000000000000ull,
+};
+
+// 5^q scaled into [2^127, 2^128), high word first; truncated for q >= 0 and rounded up for q < 0
+static const uint64_t pow5_128[][2] = {
+    {0x9e74d1b791e07e48ull, 0x775ea264cf55347eull},  // 5^-27
+    {0xc612062576589ddaull, 0x95364afe032a819eull},  // 5^-26
+    {0xf79687aed3eec551ull, 0x3a83ddbd83f52205ull},  // 5^-25
+    {0x9abe14cd44753b52ull, 0xc4926a9672793543ull},  // 5^-24
+    {0xc16d9a0095928a27ull, 0x75b7053c0f178294ull},  // 5^-23
+    {0xf1c90080baf72cb1ull, 0x5324c68b12dd6339ull},  // 5^-22
+    {0x971da05074da7beeull, 0xd3f6fc16ebca5e04ull},  // 5^-21
+    {0xbce5086492111aeaull, 0x88f4bb1ca6bcf585ull},  // 5^-20
+    {0xec1e4a7db69561a5ull, 0x2b31e9e3d06c32e6ull},  // 5^-19
+    {0x9392ee8e921d5d07ull, 0x3aff322e62439fd0ull},  // 5^-18
+    {0xb877aa3236a4b449ull, 0x09befeb9fad487c3ull},  // 5^-17
+    {0xe69594bec44de15bull, 0x4c2ebe687989a9b4ull},  // 5^-16
+    {0x901d7cf73ab0acd9ull, 0x0f9d37014bf60a11ull},  // 5^-15
+    {0xb424dc35095cd80full, 0x538484c19ef38c95ull},  // 5^-14
+    {0xe12e13424bb40e13ull, 0x2865a5f206b06fbaull},  // 5^-13
+    {0x8cbccc096f5088cbull, 0xf93f87b7442e45d4ull},  // 5^-12
+    {0xafebff0bcb24aafeull, 0xf78f69a51539d749ull},  // 5^-11
+    {0xdbe6fecebdedd5beull, 0xb573440e5a884d1cull},  // 5^-10
+    {0x89705f4136b4a597ull, 0x31680a88f8953031ull},  // 5^-9
+    {0xabcc77118461cefcull, 0xfdc20d2b36ba7c3eull},  // 5^-8
+    {0xd6bf94d5e57a42bcull, 0x3d32907604691b4dull},  // 5^-7
+    {0x8637bd05af6c69b5ull, 0xa63f9a49c2c1b110ull},  // 5^-6
+    {0xa7c5ac471b478423ull, 0x0fcf80dc33721d54ull},  // 5^-5
+    {0xd1b71758e219652bull, 0xd3c36113404ea4a9ull},  // 5^-4
+    {0x83126e978d4fdf3bull, 0x645a1cac083126eaull},  // 5^-3
+    {0xa3d70a3d70a3d70aull, 0x3d70a3d70a3d70a4ull},  // 5^-2
+    {0xccccccccccccccccull, 0xcccccccccccccccdull},  // 5^-1
+    {0x8000000000000000ull, 0x0000000000000000ull},  // 5^0
+    {0xa000000000000000ull, 0x0000000000000000ull},  // 5^1
+    {0xc800000000000000ull, 0x0000000000000000ull},  // 5^2
+    {0xfa00000000000000ull, 0x0000000000000000ull},  // 5^3
+    {0x9c40000000000000ull, 0x0000000000000000ull},  // 5^4
+    {0xc350000000000000ull, 0x0000000000000000ull},  // 5^5
+    {0xf424000000000000ull, 0x0000000000000000ull},  // 5^6
+    {0x9896800000000000ull, 0x0000000000000000ull},  // 5^7
+    {0xbebc200000000000ull, 0x0000000000000000ull},  // 5^8
+    {0xee6b280000000000ull, 0x0000000000000000ull},  // 5^9
+    {0x9502f90000000000ull, 0x0000000000000000ull},  // 5^10
+    {0xba43b74000000000ull, 0x0000000000000000ull},  // 5^11
+    {0xe8d4a51000000000ull, 0x0000000000000000ull},  // 5^12
+    {0x9184e72a00000000ull, 0x0000000000000000ull},  // 5^13
+    {0xb5e620f480000000ull, 0x0000000000000000ull},  // 5^14
+    {0xe35fa931a0000000ull, 0x0000000000000000ull},  // 5^15
+    {0x8e1bc9bf04000000ull, 0x0000000000000000ull},  // 5^16
+    {0xb1a2bc2ec5000000ull, 0x0000000000000000ull},  // 5^17
+    {0xde0b6b3a76400000ull, 0x0000000000000000ull},  // 5^18
+    {0x8ac7230489e80000ull, 0x0000000000000000ull},  // 5^19
+    {0xad78ebc5ac620000ull, 0x0000000000000000ull},  // 5^20
+    {0xd8d726b7177a8000ull, 0x0000000000000000ull},  // 5^21
+    {0x878678326eac9000ull, 0x0000000000000000ull},  // 5^22
+    {0xa968163f0a57b400ull, 0x0000000000000000ull},  // 5^23
+    {0xd3c21bcecceda100ull, 0x0000000000000000ull},  // 5^24
+    {0x84595161401484a0ull, 0x0000000000000000ull},  // 5^25
+    {0xa56fa5b99019a5c8ull, 0x0000000000000000ull},  // 5^26
+    {0xcecb8f27f4200f3aull, 0x0000000000000000ull},  // 5^27
+    {0x813f3978f8940984ull, 0x4000000000000000ull},  // 5^28
+    {0xa18f07d736b90be5ull, 0x5000000000000000ull},  // 5^29
+    {0xc9f2c9cd04674edeull, 0xa400000000000000ull},  // 5^30
+    {0xfc6f7c4045812296ull, 0x4d00000000000000ull},  // 5^31
+    {0x9dc5ada82b70b59dull, 0xf020000000000000ull},  // 5^32
+    {0xc5371912364ce305ull, 0x6c28000000000000ull},  // 5^33
+    {0xf684df56c3e01bc6ull, 0xc732000000000000ull},  // 5^34
+    {0x9a130b963a6c115cull, 0x3c7f400000000000ull},  // 5^35
+    {0xc097ce7bc90715b3ull, 0x4b9f100000000000ull},  // 5^36
+    {0xf0bdc21abb48db20ull, 0x1e86d40000000000ull},  // 5^37
+    {0x96769950b50d88f4ull, 0x1314448000000000ull},  // 5^38
+    {0xbc143fa4e250eb31ull, 0x17d955a000000000ull},  // 5^39
+    {0xeb194f8e1ae525fdull, 0x5dcfab0800000000ull},  // 5^40
+    {0x92efd1b8d0cf37beull, 0x5aa1cae500000000ull},  // 5^41
+    {0xb7abc627050305adull, 0xf14a3d9e40000000ull},  // 5^42
+    {0xe596b7b0c643c719ull, 0x6d9ccd05d0000000ull},  // 5^43
+    {0x8f7e32ce7bea5c6full, 0xe4820023a2000000ull},  // 5^44
+    {0xb35dbf821ae4f38bull, 0xdda2802c8a800000ull},  // 5^45
+    {0xe0352f62a19e306eull, 0xd50b2037ad200000ull},  // 5^46
+    {0x8c213d9da502de45ull, 0x4526f422cc340000ull},  // 5^47
+    {0xaf298d050e4395d6ull, 0x9670b12b7f410000ull},  // 5^48
+    {0xdaf3f04651d47b4cull, 0x3c0cdd765f114000ull},  // 5^49
+    {0x88d8762bf324cd0full, 0xa5880a69fb6ac800ull},  // 5^50
+    {0xab0e93b6efee0053ull, 0x8eea0d047a457a00ull},  // 5^51
+    {0xd5d238a4abe98068ull, 0x72a4904598d6d880ull},  // 5^52
+    {0x85a36366eb71f041ull, 0x47a6da2b7f864750ull},  // 5^53
+    {0xa70c3c40a64e6c51ull, 0x999090b65f67d924ull},  // 5^54
+    {0xd0cf4b50cfe20765ull, 0xfff4b4e3f741cf6dull},  // 5^55
+};
+
+// numeric literals are always digits with an optional fraction (the scanner has made sure of that), so this is
+// one walk that gathers the leading significant digits into w and the power of ten into q, value = w * 10^q.
+// The result is correctly rounded, the same double strtod would give, but without the locale and format handling
+// and without reading past the token.
+double parse_number(const char* chars, int length) {
+    const char* p = chars;
+    const char* end = chars + length;
+    uint64_t w = 0;
+    int digits = 0;
+    int q = 0;
+    bool truncated = false;     // a dropped digit was nonzero, so the value lies strictly between w and w + 1
+
+    while (p < end && *p == '0') {
+        ++p;
+    }
+    for (; p < end && *p != '.'; ++p) {
+        if (digits < MAX_DIGITS) {
+            w = w * 10 + (uint64_t)(*p - '0');
+            ++digits;
+        } else {
+            ++q;
+            truncated |= *p != '0';
+        }
+    }
+    if (p < end) {
+        ++p;    // the '.'
+        if (digits == 0) {
+            for (; p < end && *p == '0'; ++p) {
+                --q;
+            }
+        }
+        for (; p < end; ++p) {
+            if (digits < MAX_DIGITS) {
+                w = w * 10 + (uint64_t)(*p - '0');
+                ++digits;
+                --q;
+            } else {
+                truncated |= *p != '0';
+            }
+        }
+    }
+
+    if (w == 0) {
+        return 0.0;
+    }
+    double value;
+    if (!truncated && clinger(w, q, &value)) {
+        return value;
+    }
+    if (eisel_lemire(w, q, &value)) {
+        if (!truncated) {
+            return value;
+        }
+        // anything between w and w + 1 rounds the same way if both ends do
+        double upper;
+        if (eisel_lemire(w + 1, q, &upper) && upper == value) {
+            return value;
+        }
+    }
+    return parse_fallback(chars, length);
+}
+
+// w and 10^|q| are both exact doubles here, so a single multiply or divide rounds correctly. This covers the
+// common case of integers and short decimals, integers (q == 0) included. It relies on plain double arithmetic:
+// with x87 extended precision the double rounding could be off by one ulp, so leave it to Eisel-Lemire there.
+static bool clinger(uint64_t w, int q, double* out) {
+#if FLT_EVAL_METHOD == 0
+    if (w > MAX_EXACT_INT || q < -MAX_EXACT_POW10 || q > MAX_EXACT_POW10) {
+        return false;
+    }
+    *out = q >= 0 ? (double)w * exact_pow10[q] : (double)w / exact_pow10[-q];
+    return true;
+#else
+    (void)w;
+    (void)q;
+    (void)out;
+    return false;
+#endif
+}
+
+// Eisel and Lemire, "Number Parsing at a Gigabyte per Second": multiply the normalized w by a 128-bit
+// approximation of 5^q and read the binary mantissa off the top of the product. Returns false when the product
+// is too close to a halfway point to decide, or when there's no 128-bit multiply to do it with.
+static bool eisel_lemire(uint64_t w, int q, double* out) {
+#ifdef __SIZEOF_INT128__
+    if (q < MIN_LEMIRE_POW10 || q > MAX_LEMIRE_POW10) {
+        return false;
+    }
+    const uint64_t* pow5 = pow5_128[q - MIN_LEMIRE_POW10];
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+
+    // 55 bits are needed (52 stored, the implicit one, a rounding bit and one for the product's leading zero);
+    // only when all the bits below those are ones could the low half of 5^q carry into them
+    const uint64_t precision_mask = UINT64_MAX >> 55;
+    unsigned __int128 product = (unsigned __int128)w * pow5[0];
+    uint64_t high = (uint64_t)(product >> 64);
+    uint64_t low = (uint64_t)product;
+    if ((high & precision_mask) == precision_mask) {
+        uint64_t cross = (uint64_t)(((unsigned __int128)w * pow5[1]) >> 64);
+        low += cross;
+        if (cross > low) {
+            ++high;
+        }
+    }
+
+    int upper_bit = (int)(high >> 63);
+    int shift = upper_bit + 64 - 52 - 3;
+    uint64_t mantissa = high >> shift;
+    // floor(log2(10^q)) + 63 via a fixed-point log2(10), then rebiased
+    int power2 = (((152170 + 65536) * q) >> 16) + 63 + upper_bit - lz + 1023;
+
+    // exactly halfway: round to even. Only small powers of ten can produce an exact product.
+    if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == high) {
+        mantissa &= ~(uint64_t)1;
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ull << 52)) {
+        mantissa = 1ull << 52;  // rounding carried into a new bit
+        ++power2;
+    }
+    mantissa &= ~(1ull << 52);
+
+    uint64_t bits = mantissa | ((uint64_t)power2 << 52);
+    memcpy(out, &bits, sizeof(bits));
+    return true;
+#else
+    (void)w;
+    (void)q;
+    (void)out;
+    return false;
+#endif
+}
+
+// strtod needs a terminated string, and the token is followed by the rest of the source
+static double parse_fallback(const char* chars, int length) {
+    char buffer[64];
+    char* copy = (size_t)length < sizeof(buffer) ? buffer : malloc(length + 1);
+    memcpy(copy, chars, length);
+    copy[length] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != buffer) {
+        free(copy);
+    }
+    return value;
+}
+
+// printf("%g", value), byte for byte, without going through printf: the value rounded to 6 significant digits,
+// trailing zeros dropped, in fixed notation unless the exponent is below -4 or above 5
+int format_number(double value, char* buffer) {
+    if (!isfinite(value)) {
+        return format_special(value, buffer);
+    }
+    char* p = buffer;
+    if (signbit(value)) {
+        *p++ = '-';
+    }
+    if (value == 0) {
+        *p++ = '0';
+        return (int)(p - buffer);
+    }
+
+    uint64_t digits;
+    int exponent;
+    to_decimal(fabs(value), 6, &digits, &exponent);
+    return (int)(p - buffer) + write_decimal(p, digits, 6, exponent, 6);
+}
+
+// the fewest significant digits (at most 17) that parse_number() reads back as exactly value, laid out the way
+// "%.17g" would lay them out. When there's a choice at that length it's the digits nearest to value.
+int format_number_shortest(double value, char* buffer) {
+    if (!isfinite(value)) {
+        return format_special(value, buffer);
+    }
+    char* p = buffer;
+    if (signbit(value)) {
+        *p++ = '-';
+    }
+    if (value == 0) {
+        *p++ = '0';
+        return (int)(p - buffer);
+    }
+
+    // a normal double is 15.95 decimal digits, so anything that round-trips in 15 or fewer digits is the 15-digit
+    // rounding with its trailing zeros dropped. Past that the nearest decimal at each length usually decides it,
+    // but at a power of two the gap below value is half the gap above, so the interval that reads back as value
+    // can miss the nearest decimal and still hold its neighbour. Subnormals have fewer digits to give and have to
+    // count up from one.
+    double magnitude = fabs(value);
+    uint64_t digits;
+    int exponent;
+    int precision = magnitude < DBL_MIN ? 1 : 15;
+    for (;; ++precision) {
+        to_decimal(magnitude, precision, &digits, &exponent);
+        if (precision == 17 || shortest_candidate(magnitude, precision, &digits, exponent)) {
+            break;
+        }
+    }
+    return (int)(p - buffer) + write_decimal(p, digits, precision, exponent, 17);
+}
+
+static int format_special(double value, char* buffer) {
+    const char* text = isnan(value) ? (signbit(value) ? "-nan" : "nan") : (value < 0 ? "-inf" : "inf");
+    int length = (int)strlen(text);
+    memcpy(buffer, text, length);
+    return length;
+}
+
+// magnitude correctly rounded (ties to even) to precision significant digits: digits is in
+// [10^(precision - 1), 10^precision) and the value is digits * 10^(exponent - precision + 1)
+static void to_decimal(double magnitude, int precision, uint64_t* digits, int* exponent) {
+    if (lemire_decimal(magnitude, precision, digits, exponent)) {
+        return;
+    }
+
+    // printf's %e rounds exactly the same way, just slowly
+    char text[40];
+    snprintf(text, sizeof(text), "%.*e", precision - 1, magnitude);
+    uint64_t n = (uint64_t)(text[0] - '0');
+    const char* p = text + (precision > 1 ? 2 : 1);   // past the point, if there is one
+    for (; *p != 'e'; ++p) {
+        n = n * 10 + (uint64_t)(*p - '0');
+    }
+    *digits = n;
+    *exponent = atoi(p + 1);
+}
+
+// the reverse of eisel_lemire(): multiply the binary mantissa by the same 128-bit power of five so the digits
+// wanted end up as the integer part of a 192-bit product, with plenty of fraction bits below them to round on.
+// Returns false when the power of ten needed is outside the table, or when the product lands too close to halfway
+// for the table's rounding error to rule out either answer.
+static bool lemire_decimal(double magnitude, int precision, uint64_t* digits, int* exponent) {
+#ifdef __SIZEOF_INT128__
+    uint64_t bits;
+    memcpy(&bits, &magnitude, sizeof(bits));
+    uint64_t m = bits & ((1ull << 52) - 1);
+    int biased = (int)(bits >> 52);
+    int e2 = biased - 1075;
+    if (biased == 0) {
+        e2 = -1074;     // subnormal
+    } else {
+        m |= 1ull << 52;
+    }
+    int lz = __builtin_clzll(m);
+    m <<= lz;
+    e2 -= lz;
+
+    // magnitude is in [2^(e2 + 63), 2^(e2 + 64)); this guess at its decimal exponent is right or one too small
+    int x = ((e2 + 63) * 78913) >> 18;
+    for (;;) {
+        int k = precision - 1 - x;      // magnitude * 10^k has precision digits before the point
+        if (k < MIN_LEMIRE_POW10 || k > MAX_LEMIRE_POW10) {
+            return false;
+        }
+        const uint64_t* pow5 = pow5_128[k - MIN_LEMIRE_POW10];
+        unsigned __int128 upper = (unsigned __int128)m * pow5[0];
+        unsigned __int128 lower = (unsigned __int128)m * pow5[1];
+        unsigned __int128 top = upper + (uint64_t)(lower >> 64);
+        uint64_t high = (uint64_t)(top >> 64);
+        uint64_t middle = (uint64_t)top;
+        uint64_t low = (uint64_t)lower;
+
+        // pow5 is 5^k * 2^(127 - floor(log2(5^k))), so magnitude * 10^k is high:middle:low / 2^(128 + shift)
+        int shift = 127 - e2 - k - ((((152170 + 65536) * k) >> 16) - k) - 128;
+        if (shift < 1 || shift > 63) {
+            return false;
+        }
+        uint64_t n = high >> shift;
+        if (n >= int_pow10[precision]) {
+            ++x;
+            continue;
+        }
+
+        // the entries for k >= 0 are exact; the others are rounded up by less than one unit, which puts the
+        // product less than one unit of middle too high
+        uint64_t rest = high & ((1ull << shift) - 1);
+        uint64_t half = 1ull << (shift - 1);
+        if (rest == half && middle == 0) {
+            if (k < 0) {
+                return false;
+            }
+            n += low != 0 || (n & 1);   // exactly halfway: to even
+        } else {
+            n += rest > half || (rest == half && middle != 0);
+        }
+        if (n == int_pow10[precision]) {
+            n = int_pow10[precision - 1];
+            ++x;
+        }
+        *digits = n;
+        *exponent = x;
+        return true;
+    }
+#else
+    (void)magnitude;
+    (void)precision;
+    (void)digits;
+    (void)exponent;
+    return false;
+#endif
+}
+
+// whether digits * 10^q reads back as magnitude
+static bool round_trips(double magnitude, uint64_t digits, int q) {
+    double value;
+    if (!clinger(digits, q, &value) && !eisel_lemire(digits, q, &value)) {
+        char text[40];
+        snprintf(text, sizeof(text), "%llue%d", (unsigned long long)digits, q);
+        value = strtod(text, NULL);
+    }
+    return value == magnitude;
+}
+
+// whether nearest (magnitude rounded to precision digits) or one of its neighbours at that length reads back as
+// magnitude; if only a neighbour does, *digits is moved to it. Only the neighbour on the far side of magnitude from
+// nearest can be in range: the near one is further out than nearest, which already missed.
+static bool shortest_candidate(double magnitude, int precision, uint64_t* digits, int exponent) {
+    int q = exponent - precision + 1;
+    uint64_t nearest = *digits;
+    if (round_trips(magnitude, nearest, q)) {
+        return true;
+    }
+    uint64_t candidates[2] = {nearest + 1, nearest - 1};
+    for (int i = 0; i < 2; ++i) {
+        uint64_t candidate = candidates[i];
+        if (candidate >= int_pow10[precision - 1] && candidate < int_pow10[precision] &&
+            round_trips(magnitude, candidate, q)) {
+            *digits = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// lays out count significant digits (digits) whose first has power of ten exponent, as %g does: trailing zeros
+// dropped, and exponential notation when exponent < -4 or exponent >= max_fixed_exponent
+static int write_decimal(char* out, uint64_t digits, int count, int exponent, int max_fixed_exponent) {
+    while (digits % 10 == 0) {
+        digits /= 10;
+        --count;
+    }
+    char text[20];
+    int i = count;
+    do {
+        text[--i] = (char)('0' + digits % 10);
+        digits /= 10;
+    } while (i > 0);
+
+    char* p = out;
+    if (exponent < -4 || exponent >= max_fixed_exponent) {
+        *p++ = text[0];
+        if (count > 1) {
+            *p++ = '.';
+            memcpy(p, text + 1, count - 1);
+            p += count - 1;
+        }
+        *p++ = 'e';
+        *p++ = exponent < 0 ? '-' : '+';
+        int e = exponent < 0 ? -exponent : exponent;
+        if (e >= 100) {
+            *p++ = (char)('0' + e / 100);
+            e %= 100;
+        }
+        *p++ = (char)('0' + e / 10);
+        *p++ = (char)('0' + e % 10);
+    } else if (exponent >= 0) {
+        int whole = exponent + 1;
+        if (count <= whole) {
+            memcpy(p, text, count);
+            memset(p + count, '0', whole - count);
+            p += whole;
+        } else {
+            memcpy(p, text, whole);
+            p += whole;
+            *p++ = '.';
+            memcpy(p, text + whole, count - whole);
+            p += count - whole;
+        }
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -exponent - 1);
+        p += -exponent - 1;
+        memcpy(p, text, count);
+        p += count;
+    }
+    return (int)(p - out);
+}
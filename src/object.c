@@ -1,41 +1,181 @@
+// MAP_ANONYMOUS is older than its place in POSIX, and glibc only declares it with the BSD/SVID extensions
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "includes/memory.h"
 #include "includes/object.h"
+#include "includes/table.h"
 #include "includes/value.h"
 #include "includes/vm.h"
 
-#define ALLOCATE_OBJ(type, obj_type) ((type*)allocate_object(sizeof(type), obj_type))
+#define ALLOCATE_OBJ(vm, type, obj_type) ((type*)allocate_object(vm, sizeof(type), obj_type))
 
-static Obj* allocate_object(size_t size, ObjType type) {
-    Obj* obj = (Obj*)reallocate(NULL, 0, size);
+static Obj* allocate_object(VM* vm, size_t size, ObjType type) {
+    Obj* obj = (Obj*)reallocate(vm, NULL, 0, size, MEM_OBJECTS);
     obj->type = type;
+    obj->is_marked = false;
+
+    obj->next = vm->objects;
+    vm->objects = obj;
     return obj;
 }
 
-static ObjString* allocate_string(char* heap_chars, int length) {
-    ObjString* obj_str = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-    obj_str->length = length;
-    obj_str->chars = heap_chars;
-    return obj_str;
+// FNV-1a
+static uint32_t hash_string(const char* key, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; ++i) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void add_to_intern_table(VM* vm, ObjString* str) {
+    // growing the intern table can trigger a collection, and the new string isn't reachable from anywhere yet
+    push(vm, OBJ_VAL(str));
+    table_set(vm, &vm->strings, str, NIL_VAL);
+    pop(vm);
+}
+
+// a fresh, un-interned string with room for length chars (plus the terminator); the caller fills in chars and
+// then hands it to intern_string()
+ObjString* allocate_string(VM* vm, int length) {
+    ObjString* str = (ObjString*)allocate_object(vm, STRING_ALLOC_SIZE(length), OBJ_STRING);
+    str->length = length;
+    str->hash = 0;
+    str->chars = str->storage;
+    str->source = NULL;
+    str->storage[length] = '\0';
+
+    ++vm->mem_stats.string_count;
+    vm->mem_stats.string_bytes += length + 1;
+    return str;
+}
+
+// returns the canonical copy of str; if one already exists, str is released (or left to the collector if
+// something else was allocated after it)
+ObjString* intern_string(VM* vm, ObjString* str) {
+    str->hash = hash_string(str->chars, str->length);
+    ObjString* interned = table_find_string(&vm->strings, str->chars, str->length, str->hash);
+    if (interned == NULL) {
+        add_to_intern_table(vm, str);
+        return str;
+    }
+
+    if (vm->objects == (Obj*)str) {
+        vm->objects = str->obj.next;
+        free_string(vm, str);
+    }
+    return interned;
+}
+
+ObjString* copy_string(VM* vm, const char* chars, int length) {
+    uint32_t hash = hash_string(chars, length);
+    ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
+    if (interned != NULL) {
+        return interned;
+    }
+
+    ObjString* str = allocate_string(vm, length);
+    memcpy(str->storage, chars, length);
+    str->hash = hash;
+    add_to_intern_table(vm, str);
+    return str;
+}
+
+// like copy_string(), but a new string keeps pointing at chars, which must lie inside source
+ObjString* borrow_string(VM* vm, ObjSource* source, const char* chars, int length) {
+    uint32_t hash = hash_string(chars, length);
+    ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
+    if (interned != NULL) {
+        return interned;
+    }
+
+    ObjString* str = (ObjString*)allocate_object(vm, sizeof(ObjString), OBJ_STRING);
+    str->length = length;
+    str->hash = hash;
+    str->chars = chars;
+    str->source = source;
+    ++vm->mem_stats.string_count;
+    add_to_intern_table(vm, str);
+    return str;
 }
 
-ObjString* take_string(char* chars, int length) {
-    return allocate_string(chars, length);
+// a and b must stay reachable by the collector until this returns
+ObjString* concat_strings(VM* vm, ObjString* a, ObjString* b) {
+    ObjString* result = allocate_string(vm, a->length + b->length);
+    memcpy(result->storage, a->chars, a->length);
+    memcpy(result->storage + a->length, b->chars, b->length);
+    return intern_string(vm, result);
 }
 
-ObjString* copy_string(const char* chars, int length) {
-    char* heap_chars = ALLOCATE(char, length + 1);
-    memcpy(heap_chars, chars, length);
-    heap_chars[length] = '\0';
-    return allocate_string(heap_chars, length);
+// only releases the memory; unlinking from vm->objects and the intern table is the caller's job
+void free_string(VM* vm, ObjString* str) {
+    --vm->mem_stats.string_count;
+    if (str->source != NULL) {
+        reallocate(vm, str, sizeof(ObjString), 0, MEM_OBJECTS);
+        return;
+    }
+    vm->mem_stats.string_bytes -= str->length + 1;
+    reallocate(vm, str, STRING_ALLOC_SIZE(str->length), 0, MEM_OBJECTS);
+}
+
+// maps the file at path, or returns NULL if it can't be opened or mapped. The mapping is one byte longer than the
+// file and that byte is zero, since the scanner expects a NUL-terminated source.
+ObjSource* map_source(VM* vm, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // zeroed anonymous pages with the file mapped over the front: the byte after the file is a NUL even when
+    // the file exactly fills its last page
+    size_t length = (size_t)st.st_size;
+    size_t mapped_size = length + 1;
+    char* chars = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chars == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (length > 0 && mmap(chars, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(chars, mapped_size);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    ObjSource* source = (ObjSource*)allocate_object(vm, sizeof(ObjSource), OBJ_SOURCE);
+    source->chars = chars;
+    source->length = length;
+    source->mapped_size = mapped_size;
+    return source;
+}
+
+void free_source(VM* vm, ObjSource* source) {
+    munmap((void*)source->chars, source->mapped_size);
+    reallocate(vm, source, sizeof(ObjSource), 0, MEM_OBJECTS);
 }
 
 void print_obj(Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_STRING: {
-            printf("%s", AS_CSTRING(value));
+            ObjString* str = AS_STRING(value);
+            printf("%.*s", str->length, str->chars);
+            break;
+        }
+        case OBJ_SOURCE: {
+            printf("<source>");
             break;
         }
     }
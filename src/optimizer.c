@@ -0,0 +1,213 @@
+#include <stdio.h>
+
+#include "includes/chunk.h"
+#include "includes/memory.h"
+#include "includes/object.h"
+#include "includes/optimizer.h"
+#include "includes/value.h"
+
+// peephole pass over a finished chunk: each rule matches a short run of consecutive opcodes and replaces it
+// with something cheaper. Rules may only shrink the code. There are no jumps in the instruction set yet, so
+// nothing has to be re-targeted when bytes disappear; once there are, the pass has to remap jump offsets.
+
+#define MAX_PATTERN 3
+
+typedef struct {
+    uint8_t code[4];
+    int length;
+} Rewrite;
+
+// prev_op is the instruction just before the match in the already-rewritten code, or -1 at the start
+typedef bool (*RewriteFn)(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out);
+
+typedef struct {
+    const char* name;
+    int length;
+    uint8_t pattern[MAX_PATTERN];
+    RewriteFn rewrite;
+} PeepholeRule;
+
+static bool rewrite_double_not(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out);
+static bool rewrite_negate_constant(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out);
+static bool rewrite_not_constant(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out);
+static bool rewrite_not_literal(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out);
+
+static PeepholeRule rules[] = {
+    {"not-not", 2, {OP_NOT, OP_NOT}, rewrite_double_not},
+    {"negate-constant", 2, {OP_CONSTANT, OP_NEGATE}, rewrite_negate_constant},
+    {"not-constant", 2, {OP_CONSTANT, OP_NOT}, rewrite_not_constant},
+    {"not-true", 2, {OP_TRUE, OP_NOT}, rewrite_not_literal},
+    {"not-false", 2, {OP_FALSE, OP_NOT}, rewrite_not_literal},
+    {"not-nil", 2, {OP_NIL, OP_NOT}, rewrite_not_literal},
+};
+
+static int count_instructions(Chunk* chunk);
+static int match_rule(Chunk* chunk, int offset, PeepholeRule* rule);
+static bool run_pass(VM* vm, Chunk* chunk, Chunk* scratch, OptStats* stats);
+
+void optimize_chunk(VM* vm, Chunk* chunk, OptStats* stats) {
+    ++stats->chunks;
+    stats->instructions_before += count_instructions(chunk);
+
+    // one rewrite can expose another (OP_TRUE OP_NOT OP_NOT), so go until nothing matches. Passes swap the code
+    // between chunk and scratch, so after the first one neither allocates unless the code grows.
+    Chunk scratch;
+    init_chunk(&scratch);
+    while (run_pass(vm, chunk, &scratch, stats)) {}
+    FREE_ARRAY(vm, uint8_t, scratch.code, scratch.capacity, MEM_CHUNK_CODE);
+    FREE_ARRAY(vm, LineRun, scratch.lines, scratch.line_capacity, MEM_LINES);
+
+    stats->instructions_after += count_instructions(chunk);
+    chunk->max_stack = chunk_stack_depth(chunk);
+}
+
+void print_opt_stats(OptStats* stats) {
+    fprintf(stderr, "== optimizer stats ==\n");
+    fprintf(stderr, "chunks:          %d\n", stats->chunks);
+    fprintf(stderr, "rewrites:        %d\n", stats->rewrites);
+    fprintf(stderr, "instructions:    %d -> %d (%d removed)\n",
+            stats->instructions_before, stats->instructions_after,
+            stats->instructions_before - stats->instructions_after);
+}
+
+static int count_instructions(Chunk* chunk) {
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; offset += opcode_length(chunk->code[offset])) {
+        ++count;
+    }
+    return count;
+}
+
+// returns how many bytes the pattern covers at offset, or 0 if it doesn't match
+static int match_rule(Chunk* chunk, int offset, PeepholeRule* rule) {
+    int start = offset;
+    for (int i = 0; i < rule->length; ++i) {
+        if (offset >= chunk->count || chunk->code[offset] != rule->pattern[i]) {
+            return 0;
+        }
+        offset += opcode_length(chunk->code[offset]);
+    }
+    return offset - start;
+}
+
+// the rewritten code (and its line table) goes into scratch, which then trades buffers with chunk; the constants
+// stay where they are
+static bool run_pass(VM* vm, Chunk* chunk, Chunk* scratch, OptStats* stats) {
+    truncate_chunk(scratch, 0);
+    int prev_op = -1;
+    bool changed = false;
+
+    for (int offset = 0; offset < chunk->count;) {
+        int matched = 0;
+        Rewrite rewrite;
+        for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); ++i) {
+            matched = match_rule(chunk, offset, &rules[i]);
+            if (matched > 0 && rules[i].rewrite(vm, chunk, offset, prev_op, &rewrite)) {
+                break;
+            }
+            matched = 0;
+        }
+
+        int line = get_line(chunk, offset);
+        if (matched > 0) {
+            for (int i = 0; i < rewrite.length; i += opcode_length(rewrite.code[i])) {
+                prev_op = rewrite.code[i];
+            }
+            for (int i = 0; i < rewrite.length; ++i) {
+                write_chunk(vm, scratch, rewrite.code[i], line);
+            }
+            offset += matched;
+            ++stats->rewrites;
+            changed = true;
+            continue;
+        }
+
+        prev_op = chunk->code[offset];
+        int length = opcode_length(chunk->code[offset]);
+        for (int i = 0; i < length; ++i) {
+            write_chunk(vm, scratch, chunk->code[offset + i], line);
+        }
+        offset += length;
+    }
+
+    Chunk old = *chunk;
+    chunk->code = scratch->code;
+    chunk->count = scratch->count;
+    chunk->capacity = scratch->capacity;
+    chunk->lines = scratch->lines;
+    chunk->line_count = scratch->line_count;
+    chunk->line_capacity = scratch->line_capacity;
+    scratch->code = old.code;
+    scratch->capacity = old.capacity;
+    scratch->lines = old.lines;
+    scratch->line_capacity = old.line_capacity;
+    return changed;
+}
+
+static bool produces_bool(int op) {
+    switch (op) {
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GREATER_CONST:
+        case OP_LESS_CONST:
+        case OP_GREATER_NUM_NUM:
+        case OP_LESS_NUM_NUM:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// !!x is only x when x is already a boolean; otherwise the pair is what turns it into one
+static bool rewrite_double_not(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out) {
+    (void)vm;
+    (void)chunk;
+    (void)offset;
+    if (!produces_bool(prev_op)) {
+        return false;
+    }
+    out->length = 0;
+    return true;
+}
+
+static bool rewrite_negate_constant(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out) {
+    (void)prev_op;
+    Value constant = chunk->constants.values[chunk->code[offset + 1]];
+    if (!IS_NUMBER(constant)) {
+        return false;   // leave the runtime error to the VM
+    }
+
+    int constants_before = chunk->constants.count;
+    int const_idx = add_constant(vm, chunk, NUMBER_VAL(-AS_NUMBER(constant)));
+    if (const_idx > UINT8_MAX) {    // an OP_CONSTANT_LONG would be longer than the pair it replaces
+        if (chunk->constants.count != constants_before) {
+            remove_last_constant(chunk);
+        }
+        return false;
+    }
+    out->code[0] = OP_CONSTANT;
+    out->code[1] = (uint8_t)const_idx;
+    out->length = 2;
+    return true;
+}
+
+static bool rewrite_not_constant(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out) {
+    (void)vm;
+    (void)prev_op;
+    Value constant = chunk->constants.values[chunk->code[offset + 1]];
+    out->code[0] = is_falsey(constant) ? OP_TRUE : OP_FALSE;
+    out->length = 1;
+    return true;
+}
+
+static bool rewrite_not_literal(VM* vm, Chunk* chunk, int offset, int prev_op, Rewrite* out) {
+    (void)vm;
+    (void)prev_op;
+    out->code[0] = chunk->code[offset] == OP_TRUE ? OP_FALSE : OP_TRUE;
+    out->length = 1;
+    return true;
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "includes/number.h"
+#include "includes/object.h"
+#include "includes/output.h"
+
+void init_output(Output* output, FILE* file) {
+    output->file = file;
+    output->number_format = NUMBER_FORMAT_G;
+    output->length = 0;
+}
+
+void flush_output(Output* output) {
+    if (output->length > 0) {
+        fwrite(output->data, 1, output->length, output->file);
+        output->length = 0;
+    }
+}
+
+void write_output(Output* output, const char* chars, size_t length) {
+    if (output->length + length > OUTPUT_BUFFER_SIZE) {
+        flush_output(output);
+        if (length > OUTPUT_BUFFER_SIZE) {
+            fwrite(chars, 1, length, output->file);     // wouldn't fit anyway, so skip the copy
+            return;
+        }
+    }
+    memcpy(output->data + output->length, chars, length);
+    output->length += length;
+}
+
+// the same text print_value() gives, except for numbers under NUMBER_FORMAT_SHORTEST
+void write_value(Output* output, Value value) {
+    if (IS_BOOL(value)) {
+        if (AS_BOOL(value)) {
+            write_output(output, "true", 4);
+        } else {
+            write_output(output, "false", 5);
+        }
+    } else if (IS_NUMBER(value)) {
+        if (output->length + NUMBER_MAX_CHARS > OUTPUT_BUFFER_SIZE) {
+            flush_output(output);
+        }
+        char* end = output->data + output->length;
+        double number = AS_NUMBER(value);
+        output->length += output->number_format == NUMBER_FORMAT_SHORTEST ? format_number_shortest(number, end)
+                                                                          : format_number(number, end);
+    } else if (IS_NIL(value)) {
+        write_output(output, "nil", 3);
+    } else if (IS_STRING(value)) {
+        ObjString* str = AS_STRING(value);
+        write_output(output, str->chars, str->length);
+    } else {
+        write_output(output, "<source>", 8);
+    }
+}
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+
+#include "includes/pool.h"
+
+static void* new_slab(Pool* pool, int size_class);
+
+void init_pool(Pool* pool) {
+    for (int i = 0; i < POOL_CLASSES; ++i) {
+        pool->free_lists[i] = NULL;
+        pool->bump[i] = NULL;
+        pool->bump_end[i] = NULL;
+    }
+    pool->slabs = NULL;
+}
+
+void free_pool(Pool* pool) {
+    PoolSlab* slab = pool->slabs;
+    while (slab != NULL) {
+        PoolSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    init_pool(pool);
+}
+
+// size must be in (0, POOL_MAX_SIZE]
+void* pool_alloc(Pool* pool, size_t size) {
+    int size_class = POOL_SIZE_CLASS(size);
+
+    PoolBlock* block = pool->free_lists[size_class];
+    if (block != NULL) {
+        pool->free_lists[size_class] = block->next;
+        return block;
+    }
+
+    size_t block_size = (size_t)(size_class + 1) * POOL_GRANULE;
+    if (pool->bump[size_class] == NULL || (size_t)(pool->bump_end[size_class] - pool->bump[size_class]) < block_size) {
+        return new_slab(pool, size_class);
+    }
+
+    void* result = pool->bump[size_class];
+    pool->bump[size_class] += block_size;
+    return result;
+}
+
+void pool_free(Pool* pool, void* ptr, size_t size) {
+    int size_class = POOL_SIZE_CLASS(size);
+    PoolBlock* block = (PoolBlock*)ptr;
+    block->next = pool->free_lists[size_class];
+    pool->free_lists[size_class] = block;
+}
+
+// returns the first block of a fresh slab and leaves the rest to be bumped out lazily, so pages are only
+// touched as they are handed out
+static void* new_slab(Pool* pool, int size_class) {
+    PoolSlab* slab = (PoolSlab*)malloc(POOL_SLAB_SIZE);
+    if (slab == NULL) {
+        exit(1);
+    }
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    size_t block_size = (size_t)(size_class + 1) * POOL_GRANULE;
+    char* first = (char*)(slab + 1);
+    pool->bump[size_class] = first + block_size;
+    pool->bump_end[size_class] = (char*)slab + POOL_SLAB_SIZE;
+    return first;
+}
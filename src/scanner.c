@@ -4,258 +4,427 @@
 #include "includes/common.h"
 #include "includes/scanner.h"
 
-typedef struct {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
-
-Scanner scanner;
-
-static bool is_at_end();
-static Token make_token(TokenType type);
-static Token error_token(const char* msg);
-static char advance();
-static char peek();
-static char peek_next();
-static Token string_token();
-static Token number_token();
-static Token ident_token();
-static TokenType ident_type();
-static TokenType check_keyword(int start, int length, const char* rest, TokenType type);
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static bool is_at_end(Scanner* scanner);
+static Token make_token(Scanner* scanner, TokenType type);
+static Token error_token(Scanner* scanner, const char* msg);
+static char advance(Scanner* scanner);
+static char peek(Scanner* scanner);
+static char peek_next(Scanner* scanner);
+static Token string_token(Scanner* scanner);
+static Token number_token(Scanner* scanner);
+static Token input_token(Scanner* scanner);
+static Token ident_token(Scanner* scanner);
+static TokenType ident_type(Scanner* scanner);
 static bool is_digit(char c);
 static bool is_alpha(char c);
-static bool match(char expected);
-static void skip_whitespace();
-
-void init_scanner(const char* src) {
-    scanner.start = src;
-    scanner.current = src;
-    scanner.line = 1;
+static bool match(Scanner* scanner, char expected);
+static void skip_whitespace(Scanner* scanner);
+
+// the runs the scanner can skip over in bulk; each set also stops at the NUL terminator
+typedef enum {
+    STOP_NOT_BLANK,     // first byte that isn't ' ', '\t', '\r' or '\n'
+    STOP_NOT_DIGIT,
+    STOP_NOT_IDENT,     // first byte that can't continue an identifier
+    STOP_QUOTE,         // the closing '"'
+    STOP_NEWLINE,       // the end of a // comment
+} StopSet;
+
+static inline const char* scan_to(const char* p, StopSet set, int* newlines);
+
+void init_scanner(Scanner* scanner, const char* src) {
+    scanner->start = src;
+    scanner->current = src;
+    scanner->line = 1;
 }
 
-Token scan_token() {
-    skip_whitespace();
-    scanner.start = scanner.current;
+Token scan_token(Scanner* scanner) {
+    skip_whitespace(scanner);
+    scanner->start = scanner->current;
 
-    if (is_at_end()) {
-        return make_token(TOKEN_EOF);
+    if (is_at_end(scanner)) {
+        return make_token(scanner, TOKEN_EOF);
     }
 
-    char c = advance();
+    char c = advance(scanner);
 
     if (is_alpha(c)) {
-        return ident_token();
+        return ident_token(scanner);
     }
 
     if (is_digit(c)) {
-        return number_token();
+        return number_token(scanner);
     }
 
     switch (c) {
         case '(':
-            return make_token(TOKEN_LEFT_PAREN);
+            return make_token(scanner, TOKEN_LEFT_PAREN);
         case ')':
-            return make_token(TOKEN_RIGHT_PAREN);
+            return make_token(scanner, TOKEN_RIGHT_PAREN);
         case '{':
-            return make_token(TOKEN_LEFT_BRACE);
+            return make_token(scanner, TOKEN_LEFT_BRACE);
         case '}':
-            return make_token(TOKEN_RIGHT_BRACE);
+            return make_token(scanner, TOKEN_RIGHT_BRACE);
         case ';':
-            return make_token(TOKEN_SEMICOLON);
+            return make_token(scanner, TOKEN_SEMICOLON);
         case ',':
-            return make_token(TOKEN_COMMA);
+            return make_token(scanner, TOKEN_COMMA);
         case '.':
-            return make_token(TOKEN_DOT);
+            return make_token(scanner, TOKEN_DOT);
         case '-':
-            return make_token(TOKEN_MINUS);
+            return make_token(scanner, TOKEN_MINUS);
         case '+':
-            return make_token(TOKEN_PLUS);
+            return make_token(scanner, TOKEN_PLUS);
         case '*':
-            return make_token(TOKEN_STAR);
+            return make_token(scanner, TOKEN_STAR);
         case '!':
-            return make_token(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+            return make_token(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
         case '=':
-            return make_token(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+            return make_token(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
         case '<':
-            return make_token(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+            return make_token(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
         case '>':
-            return make_token(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+            return make_token(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
         case '/':
-            if (peek_next() == '/') {
-                while (peek() != '\n' && !is_at_end()) {
-                    advance();
-                }
-            } else {
-                return make_token(TOKEN_SLASH);
-            }
-            break;
+            return make_token(scanner, TOKEN_SLASH);     // comments were already skipped with the whitespace
         case '"':
-            return string_token();
+            return string_token(scanner);
+        case '$':
+            return input_token(scanner);
     }
 
-    return error_token("unexpected char");
+    return error_token(scanner, "unexpected char");
 }
 
-static char advance() {
-    char c = *scanner.current;
-    ++scanner.current;
+static char advance(Scanner* scanner) {
+    char c = *scanner->current;
+    ++scanner->current;
     return c;
 }
 
-static char peek() {
-    return *scanner.current;
+static char peek(Scanner* scanner) {
+    return *scanner->current;
 }
 
-static char peek_next() {
-    if (is_at_end()) {
+static char peek_next(Scanner* scanner) {
+    if (is_at_end(scanner)) {
         return '\0';
     }
-    return scanner.current[1];
+    return scanner->current[1];
 }
 
-static Token string_token() {
-    while (peek() != '"' && !is_at_end()) {
-        advance();
-    }
+static Token string_token(Scanner* scanner) {
+    scanner->current = scan_to(scanner->current, STOP_QUOTE, &scanner->line);
 
-    if (is_at_end()) {
-        return error_token("unterminated string");
+    if (is_at_end(scanner)) {
+        return error_token(scanner, "unterminated string");
     }
 
-    advance();  // the final "
-    return make_token(TOKEN_STRING);
+    advance(scanner);  // the final "
+    return make_token(scanner, TOKEN_STRING);
 }
 
-static Token number_token() {
-    while (is_digit(peek())) {
-        advance();
+static Token number_token(Scanner* scanner) {
+    scanner->current = scan_to(scanner->current, STOP_NOT_DIGIT, NULL);
+
+    if (peek(scanner) == '.' && is_digit(peek_next(scanner))) {
+        advance(scanner);
+        scanner->current = scan_to(scanner->current, STOP_NOT_DIGIT, NULL);
     }
+    return make_token(scanner, TOKEN_NUMBER);
+}
 
-    if (peek() == '.' && is_digit(peek_next())) {
-        advance();
-        while (is_digit(peek())) {
-            advance();
-        }
+static Token input_token(Scanner* scanner) {
+    if (!is_digit(peek(scanner))) {
+        return error_token(scanner, "Expect input number after '$'.");
     }
-    return make_token(TOKEN_NUMBER);
+    scanner->current = scan_to(scanner->current, STOP_NOT_DIGIT, NULL);
+    return make_token(scanner, TOKEN_INPUT);
 }
 
-static Token ident_token() {
-    while (is_alpha(peek()) || is_digit(peek())) { advance(); } // after the first char, we allow digits in idents too
+static Token ident_token(Scanner* scanner) {
+    scanner->current = scan_to(scanner->current, STOP_NOT_IDENT, NULL);  // after the first char, digits are allowed too
 
-    return make_token(ident_type());
+    return make_token(scanner, ident_type(scanner));
 }
 
-static TokenType ident_type() {
-    switch (*scanner.start) {
-        case 'a':
-            return check_keyword(1, 2, "nd", TOKEN_AND);
-        case 'c':
-            return check_keyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e':
-            return check_keyword(1, 3, "lse", TOKEN_ELSE);
-        case 'i':
-            return check_keyword(1, 1, "f", TOKEN_IF);
-        case 'n':
-            return check_keyword(1, 2, "il", TOKEN_NIL);
-        case 'o':
-            return check_keyword(1, 1, "r", TOKEN_OR);
-        case 'p':
-            return check_keyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r':
-            return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's':
-            return check_keyword(1, 4, "uper", TOKEN_SUPER);
-        case 'v':
-            return check_keyword(1, 2, "ar", TOKEN_VAR);
-        case 'w':
-            return check_keyword(1, 4, "hile", TOKEN_WHILE);
-        case 'f':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a':
-                        return check_keyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o':
-                        return check_keyword(2, 1, "r", TOKEN_FOR);
-                    case 'u':
-                        return check_keyword(2, 1, "n", TOKEN_FUN);
-                }
-            }
-            break;
-        case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': { return check_keyword(2, 2, "is", TOKEN_THIS); }
-                    case 'r': { return check_keyword(2, 2, "ue", TOKEN_TRUE); }
-                }
-            }
-            break;
+// the keywords as (token, spelling one character at a time). The spelling is the only copy of each name: the
+// characters ident_type() compares against, the length and the first and last characters the hash uses are all
+// taken from it, so a typo can't leave a keyword hashed to a slot its own spelling never reaches. Adding one is a
+// line here: if its hash collides with another keyword's, keyword_hash_is_perfect() stops the build, and
+// KEYWORD_HASH or KEYWORD_SLOTS needs retuning.
+#define KEYWORDS(X) \
+    X(TOKEN_AND, 'a', 'n', 'd') \
+    X(TOKEN_CLASS, 'c', 'l', 'a', 's', 's') \
+    X(TOKEN_ELSE, 'e', 'l', 's', 'e') \
+    X(TOKEN_FALSE, 'f', 'a', 'l', 's', 'e') \
+    X(TOKEN_FOR, 'f', 'o', 'r') \
+    X(TOKEN_FUN, 'f', 'u', 'n') \
+    X(TOKEN_IF, 'i', 'f') \
+    X(TOKEN_NIL, 'n', 'i', 'l') \
+    X(TOKEN_OR, 'o', 'r') \
+    X(TOKEN_PRINT, 'p', 'r', 'i', 'n', 't') \
+    X(TOKEN_RETURN, 'r', 'e', 't', 'u', 'r', 'n') \
+    X(TOKEN_SUPER, 's', 'u', 'p', 'e', 'r') \
+    X(TOKEN_THIS, 't', 'h', 'i', 's') \
+    X(TOKEN_TRUE, 't', 'r', 'u', 'e') \
+    X(TOKEN_VAR, 'v', 'a', 'r') \
+    X(TOKEN_WHILE, 'w', 'h', 'i', 'l', 'e')
+
+// a string literal's characters aren't integer constants in C, so the hash can't be taken from "while"; these pick
+// the length and the first and last of up to eight characters instead
+#define KEYWORD_NTH(c1, c2, c3, c4, c5, c6, c7, c8, n, ...) n
+#define KEYWORD_LENGTH(...) KEYWORD_NTH(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define KEYWORD_FIRST(c1, ...) c1
+#define KEYWORD_LAST(...) \
+    KEYWORD_NTH(__VA_ARGS__, KEYWORD_LAST8, KEYWORD_LAST7, KEYWORD_LAST6, KEYWORD_LAST5, KEYWORD_LAST4, \
+                KEYWORD_LAST3, KEYWORD_LAST2, KEYWORD_LAST1, 0)(__VA_ARGS__)
+#define KEYWORD_LAST1(c1) c1
+#define KEYWORD_LAST2(c1, c2) c2
+#define KEYWORD_LAST3(c1, c2, c3) c3
+#define KEYWORD_LAST4(c1, c2, c3, c4) c4
+#define KEYWORD_LAST5(c1, c2, c3, c4, c5) c5
+#define KEYWORD_LAST6(c1, c2, c3, c4, c5, c6) c6
+#define KEYWORD_LAST7(c1, c2, c3, c4, c5, c6, c7) c7
+#define KEYWORD_LAST8(c1, c2, c3, c4, c5, c6, c7, c8) c8
+#define KEYWORD_SPELLING_HASH(...) \
+    KEYWORD_HASH(KEYWORD_LENGTH(__VA_ARGS__), KEYWORD_FIRST(__VA_ARGS__), KEYWORD_LAST(__VA_ARGS__))
+
+// perfect over KEYWORDS (and still over break/continue/import, should they be added)
+#define KEYWORD_SLOTS 32
+#define KEYWORD_HASH(length, first, last) \
+    (((unsigned)(length) + 7u * (unsigned char)(first) + (unsigned char)(last)) & (KEYWORD_SLOTS - 1))
+
+typedef struct {
+    const char* name;   // length characters, not terminated
+    int length;         // 0 for an empty slot, which no identifier can match
+    TokenType type;
+} Keyword;
+
+#define KEYWORD_SLOT(type, ...) \
+    [KEYWORD_SPELLING_HASH(__VA_ARGS__)] = {(const char[]){__VA_ARGS__}, KEYWORD_LENGTH(__VA_ARGS__), type},
+static const Keyword keywords[KEYWORD_SLOTS] = {KEYWORDS(KEYWORD_SLOT)};
+#undef KEYWORD_SLOT
+
+// never called: it exists so that two keywords hashing to the same slot are a duplicate case label, which is a
+// compile error, rather than one silently overwriting the other in keywords[]
+#define KEYWORD_CASE(type, ...) case KEYWORD_SPELLING_HASH(__VA_ARGS__):
+static inline bool keyword_hash_is_perfect(unsigned slot) {
+    switch (slot) {
+        KEYWORDS(KEYWORD_CASE)
+            return true;
     }
-    return TOKEN_IDENTIFIER;
+    return false;
 }
-
-static TokenType check_keyword(int start, int length, const char* rest, TokenType type) {
-    if (scanner.current - scanner.start == start + length && memcmp(scanner.start + start, rest, length) == 0) {
-        return type;
+#undef KEYWORD_CASE
+
+// one probe: the slot for the identifier's length and first and last characters holds the only keyword it could be
+static TokenType ident_type(Scanner* scanner) {
+    int length = (int)(scanner->current - scanner->start);
+    const Keyword* keyword = &keywords[KEYWORD_HASH(length, scanner->start[0], scanner->current[-1])];
+    if (keyword->length != length) {
+        return TOKEN_IDENTIFIER;
     }
-
-    return TOKEN_IDENTIFIER;
+    // keywords are a handful of bytes, too short for a memcmp() call to pay for itself
+    for (int i = 0; i < length; ++i) {
+        if (keyword->name[i] != scanner->start[i]) {
+            return TOKEN_IDENTIFIER;
+        }
+    }
+    return keyword->type;
 }
 
+// one unsigned compare per range instead of two signed ones
 static bool is_digit(char c) {
-    return (c >= '0' && c <= '9');
+    return (unsigned char)(c - '0') < 10;
 }
 
 static bool is_alpha(char c) {
-    bool is_lower_case = (c >= 'a' && c <= 'z');
-    bool is_upper_case = (c >= 'A' && c <= 'Z');
-    return (is_lower_case || is_upper_case || c == '_');
+    return (unsigned char)((c | 0x20) - 'a') < 26 || c == '_';   // | 0x20 folds upper case onto lower case
 }
 
-static bool match(char expected) {
-    if (is_at_end()) {
+static bool match(Scanner* scanner, char expected) {
+    if (is_at_end(scanner)) {
         return false;
     }
-    if (*scanner.current != expected) {
+    if (*scanner->current != expected) {
         return false;
     }
-    ++scanner.current;
+    ++scanner->current;
     return true;
 }
 
-static bool is_at_end() {
-    return *scanner.current == '\0';
+static bool is_at_end(Scanner* scanner) {
+    return *scanner->current == '\0';
 }
 
-static Token make_token(TokenType type) {
+static Token make_token(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
     return token;
 }
 
-static Token error_token(const char* msg) {
+static Token error_token(Scanner* scanner, const char* msg) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = msg;
     token.length = (int)strlen(msg);
+    token.line = scanner->line;
     return token;
 }
 
-static void skip_whitespace() {
+static void skip_whitespace(Scanner* scanner) {
     for (;;) {
-        char c = peek();
-        switch (c) {
+        switch (peek(scanner)) {
             case ' ':
-            case '\n':
             case '\r':
             case '\t':
-                advance();
+            case '\n':
+                scanner->current = scan_to(scanner->current, STOP_NOT_BLANK, &scanner->line);
+                break;
+            case '/':
+                if (peek_next(scanner) != '/') {
+                    return;
+                }
+                scanner->current = scan_to(scanner->current, STOP_NEWLINE, NULL);
                 break;
             default:
                 return;
         }
     }
-}
\ No newline at end of file
+}
+
+// most runs (an identifier, a number, the space between two tokens) are a few bytes long, and setting up a block
+// costs more than that, so scan_to() goes one byte at a time for this long before switching to blocks
+#define SCALAR_PREFIX 8
+
+static inline bool in_set(char c, StopSet set) {
+    switch (set) {
+        case STOP_NOT_BLANK: return c != ' ' && c != '\t' && c != '\r' && c != '\n';
+        case STOP_NOT_DIGIT: return !is_digit(c);
+        case STOP_NOT_IDENT: return !is_alpha(c) && !is_digit(c);
+        case STOP_QUOTE: return c == '"' || c == '\0';
+        case STOP_NEWLINE: return c == '\n' || c == '\0';
+    }
+    return true;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+// Bulk scanning a block at a time. Loads are aligned, so a block never straddles a page boundary: starting at or
+// before the terminator, the scan can't touch a page the source doesn't. Bytes outside the string (before p, or
+// after the NUL) may still be read, which the address sanitizer can't tell apart from an overflow.
+#if defined(__AVX2__)
+typedef __m256i Block;
+#define BLOCK_SIZE 32
+#define BLOCK_ALL 0xffffffffu
+#define block_load(p) _mm256_load_si256((const __m256i*)(p))
+#define block_splat(c) _mm256_set1_epi8(c)
+#define block_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define block_gt(a, b) _mm256_cmpgt_epi8(a, b)
+#define block_or(a, b) _mm256_or_si256(a, b)
+#define block_movemask(a) ((uint32_t)_mm256_movemask_epi8(a))
+#else
+typedef __m128i Block;
+#define BLOCK_SIZE 16
+#define BLOCK_ALL 0xffffu
+#define block_load(p) _mm_load_si128((const __m128i*)(p))
+#define block_splat(c) _mm_set1_epi8(c)
+#define block_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define block_gt(a, b) _mm_cmpgt_epi8(a, b)
+#define block_or(a, b) _mm_or_si128(a, b)
+#define block_movemask(a) ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+// set where b is outside [low, high]. Byte compares are signed, so anything >= 0x80 is outside every range used
+// here, as it is for is_alpha()
+static inline Block out_of_range(Block b, char low, char high) {
+    return block_or(block_gt(block_splat(low), b), block_gt(b, block_splat(high)));
+}
+
+// a bit per byte of the block that ends the run
+static inline uint32_t stop_mask(Block b, StopSet set) {
+    switch (set) {
+        case STOP_NOT_BLANK: {
+            Block space_or_tab = block_or(block_eq(b, block_splat(' ')), block_eq(b, block_splat('\t')));
+            Block line_break = block_or(block_eq(b, block_splat('\r')), block_eq(b, block_splat('\n')));
+            return ~block_movemask(block_or(space_or_tab, line_break)) & BLOCK_ALL;
+        }
+        case STOP_NOT_DIGIT:
+            return block_movemask(out_of_range(b, '0', '9'));
+        case STOP_NOT_IDENT: {
+            uint32_t alpha = ~block_movemask(out_of_range(block_or(b, block_splat(0x20)), 'a', 'z'));
+            uint32_t digit = ~block_movemask(out_of_range(b, '0', '9'));
+            uint32_t underscore = block_movemask(block_eq(b, block_splat('_')));
+            return ~(alpha | digit | underscore) & BLOCK_ALL;
+        }
+        case STOP_QUOTE:
+            return block_movemask(block_or(block_eq(b, block_splat('"')), block_eq(b, block_splat('\0'))));
+        case STOP_NEWLINE:
+            return block_movemask(block_or(block_eq(b, block_splat('\n')), block_eq(b, block_splat('\0'))));
+    }
+    return BLOCK_ALL;
+}
+
+__attribute__((no_sanitize_address))
+static const char* scan_blocks(const char* p, StopSet set, int* newlines) {
+    size_t misalign = (uintptr_t)p & (BLOCK_SIZE - 1);
+    const char* block = p - misalign;
+    uint32_t live = (BLOCK_ALL << misalign) & BLOCK_ALL;  // the bytes of the first block that come before p don't count
+
+    for (;;) {
+        Block b = block_load(block);
+        uint32_t stops = stop_mask(b, set) & live;
+        if (newlines != NULL) {
+            uint32_t skipped = stops == 0 ? live : live & ((stops & -stops) - 1);
+            *newlines += __builtin_popcount(block_movemask(block_eq(b, block_splat('\n'))) & skipped);
+        }
+        if (stops != 0) {
+            return block + __builtin_ctz(stops);
+        }
+        block += BLOCK_SIZE;
+        live = BLOCK_ALL;
+    }
+}
+
+#undef block_load
+#undef block_splat
+#undef block_eq
+#undef block_gt
+#undef block_or
+#undef block_movemask
+
+#else
+
+static const char* scan_blocks(const char* p, StopSet set, int* newlines) {
+    while (!in_set(*p, set)) {
+        if (*p == '\n' && newlines != NULL) {
+            ++*newlines;
+        }
+        ++p;
+    }
+    return p;
+}
+
+#endif
+
+// returns the first byte at or after p that's in set, adding the '\n's skipped on the way to *newlines
+static inline const char* scan_to(const char* p, StopSet set, int* newlines) {
+    for (int i = 0; i < SCALAR_PREFIX; ++i, ++p) {
+        if (in_set(*p, set)) {
+            return p;
+        }
+        if (*p == '\n' && newlines != NULL) {
+            ++*newlines;
+        }
+    }
+    return scan_blocks(p, set, newlines);
+}
@@ -0,0 +1,217 @@
+// open_memstream() and S_ISSOCK are POSIX rather than C
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "includes/server.h"
+#include "includes/output.h"
+#include "includes/vm.h"
+
+static ssize_t read_full(int fd, void* buffer, size_t size);
+static bool write_response(int fd, uint32_t status, char* output, size_t output_size, char* errors,
+                           size_t errors_size);
+static void put_u32(uint8_t* bytes, uint32_t value);
+static uint32_t get_u32(const uint8_t* bytes);
+
+// answers requests read from in on out, one at a time on the same warm VM: the stack, the intern table, the heap
+// and the allocator pools all carry over from one request to the next. Returns false if the session broke off
+// instead of ending cleanly between requests.
+bool serve_stream(VM* vm, int in, int out) {
+    FILE* stdout_file = vm->output.file;
+    NumberFormat number_format = vm->output.number_format;
+    FILE* stderr_file = vm->errors;
+    bool listings = vm->listings;
+    vm->listings = false;
+
+    char* source = NULL;
+    size_t capacity = 0;
+    bool ok = true;
+    for (;;) {
+        uint8_t header[4];
+        ssize_t got = read_full(in, header, sizeof(header));
+        if (got != sizeof(header)) {
+            ok = got == 0;
+            break;
+        }
+        uint32_t length = get_u32(header);
+        if (length > SERVE_MAX_REQUEST) {
+            ok = false;
+            break;
+        }
+        if (capacity < (size_t)length + 1) {
+            char* grown = realloc(source, (size_t)length + 1);
+            if (grown == NULL) {
+                ok = false;     // the body is still unread, so the session can't go on; the caller exits with 74
+                break;
+            }
+            source = grown;
+            capacity = (size_t)length + 1;
+        }
+        if (read_full(in, source, length) != (ssize_t)length) {
+            ok = false;
+            break;
+        }
+        source[length] = '\0';
+
+        char* output_chars = NULL;
+        size_t output_size = 0;
+        char* errors_chars = NULL;
+        size_t errors_size = 0;
+        FILE* output = open_memstream(&output_chars, &output_size);
+        FILE* errors = open_memstream(&errors_chars, &errors_size);
+        if (output == NULL || errors == NULL) {
+            if (output != NULL) {
+                fclose(output);
+            }
+            if (errors != NULL) {
+                fclose(errors);
+            }
+            free(output_chars);
+            free(errors_chars);
+            ok = false;
+            break;
+        }
+        init_output(&vm->output, output);
+        vm->output.number_format = number_format;
+        vm->errors = errors;
+
+        reset_vm(vm);
+        InterpretResult result = interpret(vm, source);
+        flush_output(&vm->output);
+        fclose(output);
+        fclose(errors);
+
+        uint32_t status = result == INTERPRET_OK ? 0 : result == INTERPRET_COMPILE_ERR ? 65 : 70;
+        ok = write_response(out, status, output_chars, output_size, errors_chars, errors_size);
+        free(output_chars);
+        free(errors_chars);
+        if (!ok) {
+            break;
+        }
+    }
+
+    free(source);
+    init_output(&vm->output, stdout_file);
+    vm->output.number_format = number_format;
+    vm->errors = stderr_file;
+    vm->listings = listings;
+    return ok;
+}
+
+// serves one connection at a time on a Unix domain socket at path, for good; only returns (with 74) if the socket
+// can't be set up
+int serve_socket(VM* vm, const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+        return 74;
+    }
+    strcpy(address.sun_path, path);
+
+    // a socket left behind by an earlier server would make bind() fail; anything else at path is left alone
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        int error = errno;
+        if (listener >= 0) {
+            close(listener);
+        }
+        fprintf(stderr, "Could not listen on \"%s\": %s.\n", path, strerror(error));
+        return 74;
+    }
+    signal(SIGPIPE, SIG_IGN);   // a client that hangs up early only ends its own session
+
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "Could not accept on \"%s\": %s.\n", path, strerror(errno));
+            close(listener);
+            return 74;
+        }
+        serve_stream(vm, client, client);
+        close(client);
+    }
+}
+
+// returns how much was read, which is less than size only at end of input, or -1 on an error
+static ssize_t read_full(int fd, void* buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t got = read(fd, (char*)buffer + total, size - total);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        total += (size_t)got;
+    }
+    return (ssize_t)total;
+}
+
+// the header and both bodies go out in one writev() where possible
+static bool write_response(int fd, uint32_t status, char* output, size_t output_size, char* errors,
+                           size_t errors_size) {
+    uint8_t header[12];
+    put_u32(header, status);
+    put_u32(header + 4, (uint32_t)output_size);
+    put_u32(header + 8, (uint32_t)errors_size);
+    struct iovec parts[] = {
+        {header, sizeof(header)},
+        {output, output_size},
+        {errors, errors_size},
+    };
+
+    int first = 0;
+    int count = sizeof(parts) / sizeof(parts[0]);
+    while (first < count) {
+        ssize_t written = writev(fd, parts + first, count - first);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            return false;
+        }
+        while (first < count && (size_t)written >= parts[first].iov_len) {
+            written -= (ssize_t)parts[first].iov_len;
+            ++first;
+        }
+        if (first < count) {
+            parts[first].iov_base = (char*)parts[first].iov_base + written;
+            parts[first].iov_len -= (size_t)written;
+        }
+    }
+    return true;
+}
+
+static void put_u32(uint8_t* bytes, uint32_t value) {
+    bytes[0] = (uint8_t)value;
+    bytes[1] = (uint8_t)(value >> 8);
+    bytes[2] = (uint8_t)(value >> 16);
+    bytes[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t get_u32(const uint8_t* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "includes/memory.h"
+#include "includes/object.h"
+#include "includes/table.h"
+#include "includes/value.h"
+
+#define TABLE_MAX_LOAD 0.75
+
+static Entry* find_entry(Entry* entries, int capacity, ObjString* key);
+static void adjust_capacity(VM* vm, Table* table, int capacity);
+
+void init_table(Table* table) {
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+}
+
+void free_table(VM* vm, Table* table) {
+    FREE_ARRAY(vm, Entry, table->entries, table->capacity, MEM_TABLES);
+    init_table(table);
+}
+
+// returns true if the key was not in the table before
+bool table_set(VM* vm, Table* table, ObjString* key, Value value) {
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+        adjust_capacity(vm, table, GROW_CAPACITY(table->capacity));
+    }
+
+    Entry* entry = find_entry(table->entries, table->capacity, key);
+    bool is_new_key = entry->key == NULL;
+    if (is_new_key && IS_NIL(entry->value)) {     // reusing a tombstone doesn't change the count
+        ++table->count;
+    }
+
+    entry->key = key;
+    entry->value = value;
+    return is_new_key;
+}
+
+// leaves a tombstone (NULL key, true value) behind so probe sequences running through this slot aren't cut short
+bool table_delete(Table* table, ObjString* key) {
+    if (table->count == 0) {
+        return false;
+    }
+
+    Entry* entry = find_entry(table->entries, table->capacity, key);
+    if (entry->key == NULL) {
+        return false;
+    }
+
+    entry->key = NULL;
+    entry->value = BOOL_VAL(true);
+    return true;
+}
+
+// the one place where strings are compared by their bytes; everything else can compare the interned pointers
+ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash) {
+    if (table->count == 0) {
+        return NULL;
+    }
+
+    uint32_t index = hash & (table->capacity - 1);
+    for (;;) {
+        Entry* entry = &table->entries[index];
+        if (entry->key == NULL) {
+            if (IS_NIL(entry->value)) {
+                return NULL;
+            }
+        } else if (entry->key->length == length && entry->key->hash == hash && memcmp(entry->key->chars, chars, length) == 0) {
+            return entry->key;
+        }
+
+        index = (index + 1) & (table->capacity - 1);
+    }
+}
+
+// called between marking and sweeping: drops every string the collector is about to free
+void table_remove_white(Table* table) {
+    for (int i = 0; i < table->capacity; ++i) {
+        Entry* entry = &table->entries[i];
+        if (entry->key != NULL && !entry->key->obj.is_marked) {
+            table_delete(table, entry->key);
+        }
+    }
+}
+
+// open addressing with linear probing; capacity is always a power of two so the modulo is a mask
+static Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
+    uint32_t index = key->hash & (capacity - 1);
+    Entry* tombstone = NULL;
+    for (;;) {
+        Entry* entry = &entries[index];
+        if (entry->key == NULL) {
+            if (IS_NIL(entry->value)) {
+                return tombstone != NULL ? tombstone : entry;
+            }
+            if (tombstone == NULL) {
+                tombstone = entry;
+            }
+        } else if (entry->key == key) {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void adjust_capacity(VM* vm, Table* table, int capacity) {
+    Entry* entries = ALLOCATE(vm, Entry, capacity, MEM_TABLES);
+    for (int i = 0; i < capacity; ++i) {
+        entries[i].key = NULL;
+        entries[i].value = NIL_VAL;
+    }
+
+    table->count = 0;   // tombstones aren't copied over, so recount the live entries
+
+    for (int i = 0; i < table->capacity; ++i) {
+        Entry* entry = &table->entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+
+        Entry* dest = find_entry(entries, capacity, entry->key);
+        dest->key = entry->key;
+        dest->value = entry->value;
+        ++table->count;
+    }
+
+    FREE_ARRAY(vm, Entry, table->entries, table->capacity, MEM_TABLES);
+    table->entries = entries;
+    table->capacity = capacity;
+}
@@ -1,49 +1,71 @@
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "includes/value.h"
 #include "includes/memory.h"
+#include "includes/number.h"
 #include "includes/object.h"
 
+static bool strings_equal(Value a, Value b);
+
 void init_value_arr(ValueArr* arr) {
     arr->count = 0;
     arr->capacity = 0;
     arr->values = NULL;
 }
 
-void free_value_arr(ValueArr* arr) {
-    FREE_ARRAY(Value, arr, arr->capacity);
+void free_value_arr(VM* vm, ValueArr* arr) {
+    FREE_ARRAY(vm, Value, arr->values, arr->capacity, MEM_CONSTANTS);
     init_value_arr(arr);
 }
 
-void write_value_arr(ValueArr* arr, Value value) {
+void write_value_arr(VM* vm, ValueArr* arr, Value value) {
     if (arr->capacity < arr->count + 1) {
         int old_cap = arr->capacity;
         arr->capacity = GROW_CAPACITY(old_cap);
-        arr->values = GROW_ARRAY(Value, arr->values, old_cap, arr->capacity);
+        arr->values = GROW_ARRAY(vm, Value, arr->values, old_cap, arr->capacity, MEM_CONSTANTS);
     }
 
     arr->values[arr->count] = value;
     ++arr->count;
 }
 
+// strings are interned, so within one heap the pointer is enough; a script's constants come from a heap of its
+// own though, so strings from different heaps are compared by contents once the cached hashes agree
+static bool strings_equal(Value a, Value b) {
+    ObjString* x = AS_STRING(a);
+    ObjString* y = AS_STRING(b);
+    return x->hash == y->hash && x->length == y->length && memcmp(x->chars, y->chars, x->length) == 0;
+}
+
+bool values_equal(Value a, Value b) {
+#ifdef NAN_BOXING
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);    // NaN != NaN, and 0 == -0, so the raw bits are not enough here
+    }
+    return a == b || (IS_STRING(a) && IS_STRING(b) && strings_equal(a, b));
+#else
+    if (a.type != b.type) { return false; }
+    switch (a.type) {
+        case VAL_NIL: { return true; }
+        case VAL_BOOL: { return AS_BOOL(a) == AS_BOOL(b);}
+        case VAL_NUMBER: { return AS_NUMBER(a) == AS_NUMBER(b); }
+        case VAL_OBJ: { return AS_OBJ(a) == AS_OBJ(b) || (IS_STRING(a) && IS_STRING(b) && strings_equal(a, b)); }
+        default: return false;
+    }
+#endif
+}
+
 void print_value(Value value) {
-    switch (value.type) {
-        case VAL_BOOL: { 
-            printf(AS_BOOL(value) ? "true" : "false"); 
-            break; 
-        }
-        case VAL_NUMBER: {
-            printf("%g", AS_NUMBER(value));
-            break;
-        }
-        case VAL_NIL: {
-            printf("nil");
-            break;
-        }
-        case VAL_OBJ: {
-            print_obj(value);
-            break;
-        }
+    if (IS_BOOL(value)) {
+        printf(AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NUMBER(value)) {
+        char text[NUMBER_MAX_CHARS];
+        fwrite(text, 1, format_number(AS_NUMBER(value), text), stdout);
+    } else if (IS_NIL(value)) {
+        printf("nil");
+    } else if (IS_OBJ(value)) {
+        print_obj(value);
     }
 }
\ No newline at end of file
@@ -1,5 +1,10 @@
+// clock_gettime() for the opcode profiler where there is no cycle counter
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "includes/vm.h"
@@ -9,184 +14,692 @@
 #include "includes/debug.h"
 #include "includes/object.h"
 #include "includes/memory.h"
+#include "includes/optimizer.h"
 
-VM vm;
+// ids for compile_script(), which several threads may call at once; 0 is left for "no script"
+static atomic_uint_fast64_t next_script_id = 1;
 
-static void reset_stack() {
-    vm.stack_top = vm.stack;
+#ifdef PROFILE_OPCODES
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_UNIT "cycles"
+static inline uint64_t profile_clock() {
+    return __rdtsc();
+}
+#else
+#include <time.h>
+#define PROFILE_UNIT "ns"
+static inline uint64_t profile_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
 }
+#endif
 
-static void runtime_error(const char* format, ...) {
+// charges the time since the current instruction started to it, then starts timing opcode; -1 just stops the clock
+static inline void profile_step(VM* vm, int opcode) {
+    OpcodeProfile* profile = &vm->profile;
+    uint64_t now = profile_clock();
+    if (profile->previous >= 0) {
+        profile->ticks[profile->previous] += now - profile->started;
+        if (opcode >= 0) {
+            ++profile->pairs[profile->previous][opcode];
+        }
+    }
+    if (opcode >= 0) {
+        ++profile->counts[opcode];
+    }
+    profile->before = profile->previous;
+    profile->previous = opcode;
+    profile->started = now;
+}
+
+// the specialized instruction being timed failed its guard and is about to run as generic: count it, and the pair
+// leading to it, as generic instead, and keep its clock running
+static inline void profile_deopt(VM* vm, int generic) {
+    OpcodeProfile* profile = &vm->profile;
+    --profile->counts[profile->previous];
+    ++profile->counts[generic];
+    if (profile->before >= 0) {
+        --profile->pairs[profile->before][profile->previous];
+        ++profile->pairs[profile->before][generic];
+    }
+    profile->previous = generic;
+}
+#endif
+
+static void reset_stack(VM* vm) {
+    vm->stack_top = vm->stack;
+}
+
+static void runtime_error(VM* vm, const char* format, ...) {
+#ifdef PROFILE_OPCODES
+    profile_step(vm, -1);   // every error leaves run() through here
+#endif
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->errors, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->errors);
 
-    size_t instruction = vm.ip - vm.chunk->code - 1;
-    //   int line = vm.chunk->lines[instruction];
-    reset_stack();
+    size_t instruction = vm->ip - vm->chunk->code - 1;
+    fprintf(vm->errors, "[line %d] in script\n", get_line(vm->chunk, (int)instruction));
+    reset_stack(vm);
 }
 
-void init_vm() {
-    reset_stack();
+// the one bounds check for the whole run: after this, push() can't overflow while executing chunk
+static void ensure_stack(VM* vm, Chunk* chunk) {
+    int needed = chunk->max_stack + STACK_SLACK;
+    if (needed <= vm->stack_capacity) {
+        return;
+    }
+
+    int old_capacity = vm->stack_capacity;
+    int capacity = old_capacity;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    size_t depth = vm->stack_top - vm->stack;
+    vm->stack = GROW_ARRAY(vm, Value, vm->stack, old_capacity, capacity, MEM_STACK);
+    vm->stack_capacity = capacity;
+    vm->stack_top = vm->stack + depth;
+}
+
+#ifdef QUICKEN_STATS
+// for reporting several VMs' runs as one
+void add_quicken_stats(QuickenStats* total, const QuickenStats* stats) {
+    total->generic += stats->generic;
+    total->specialized += stats->specialized;
+    total->quickened += stats->quickened;
+    total->deopts += stats->deopts;
+}
+
+void print_quicken_stats(QuickenStats* stats) {
+    uint64_t total = stats->generic + stats->specialized;
+    fprintf(stderr, "== quickening stats ==\n");
+    fprintf(stderr, "generic executions:      %llu\n", (unsigned long long)stats->generic);
+    fprintf(stderr, "specialized executions:  %llu (%.1f%%)\n", (unsigned long long)stats->specialized,
+            total == 0 ? 0.0 : 100.0 * stats->specialized / total);
+    fprintf(stderr, "sites quickened:         %llu\n", (unsigned long long)stats->quickened);
+    fprintf(stderr, "deoptimizations:         %llu\n", (unsigned long long)stats->deopts);
 }
+#endif
 
-void free_vm() {
+#ifdef PROFILE_OPCODES
+typedef struct {
+    int first;
+    int second;     // -1 for a single opcode
+    uint64_t count;
+} ProfileEntry;
 
+static int compare_profile_entries(const void* a, const void* b) {
+    uint64_t x = ((const ProfileEntry*)a)->count;
+    uint64_t y = ((const ProfileEntry*)b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
 }
 
-void push(Value value) {
-    *vm.stack_top = value;
-    ++vm.stack_top;
+#define PROFILE_TOP_PAIRS 20
+
+// for reporting several VMs' runs as one; total's clock is left alone
+void add_opcode_profile(OpcodeProfile* total, const OpcodeProfile* profile) {
+    for (int a = 0; a < OPCODE_COUNT; ++a) {
+        total->counts[a] += profile->counts[a];
+        total->ticks[a] += profile->ticks[a];
+        for (int b = 0; b < OPCODE_COUNT; ++b) {
+            total->pairs[a][b] += profile->pairs[a][b];
+        }
+    }
+}
+
+// opcodes by the time spent in them, then the most frequent pairs. Times include the profiler's own clock reads,
+// which weighs most on the cheapest instructions.
+void print_opcode_profile(OpcodeProfile* profile) {
+    ProfileEntry entries[OPCODE_COUNT];
+    int entry_count = 0;
+    uint64_t total_count = 0;
+    uint64_t total_ticks = 0;
+    for (int op = 0; op < OPCODE_COUNT; ++op) {
+        if (profile->counts[op] > 0) {
+            entries[entry_count++] = (ProfileEntry){op, -1, profile->ticks[op]};
+            total_count += profile->counts[op];
+            total_ticks += profile->ticks[op];
+        }
+    }
+    qsort(entries, entry_count, sizeof(ProfileEntry), compare_profile_entries);
+
+    fprintf(stderr, "== opcode profile ==\n");
+    fprintf(stderr, "%-20s %12s %7s %14s %9s %7s\n", "opcode", "count", "count%", PROFILE_UNIT, "per op", "time%");
+    for (int i = 0; i < entry_count; ++i) {
+        int op = entries[i].first;
+        fprintf(stderr, "%-20s %12llu %6.1f%% %14llu %9.1f %6.1f%%\n", opcode_name(op),
+                (unsigned long long)profile->counts[op], 100.0 * profile->counts[op] / total_count,
+                (unsigned long long)profile->ticks[op], (double)profile->ticks[op] / profile->counts[op],
+                total_ticks == 0 ? 0.0 : 100.0 * profile->ticks[op] / total_ticks);
+    }
+
+    ProfileEntry pairs[OPCODE_COUNT * OPCODE_COUNT];
+    int pair_count = 0;
+    uint64_t total_pairs = 0;
+    for (int a = 0; a < OPCODE_COUNT; ++a) {
+        for (int b = 0; b < OPCODE_COUNT; ++b) {
+            if (profile->pairs[a][b] > 0) {
+                pairs[pair_count++] = (ProfileEntry){a, b, profile->pairs[a][b]};
+                total_pairs += profile->pairs[a][b];
+            }
+        }
+    }
+    qsort(pairs, pair_count, sizeof(ProfileEntry), compare_profile_entries);
+
+    fprintf(stderr, "%-41s %12s %7s\n", "pair", "count", "pairs%");
+    for (int i = 0; i < pair_count && i < PROFILE_TOP_PAIRS; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s -> %s", opcode_name(pairs[i].first), opcode_name(pairs[i].second));
+        fprintf(stderr, "%-41s %12llu %6.1f%%\n", name, (unsigned long long)pairs[i].count,
+                100.0 * pairs[i].count / total_pairs);
+    }
 }
+#endif
+
+void init_vm(VM* vm) {
+    vm->stack = NULL;
+    vm->stack_capacity = 0;
+    vm->stack_top = NULL;
+    vm->result = NIL_VAL;
+    vm->chunk = NULL;
+    vm->compiling = NULL;
+    vm->objects = NULL;
+    vm->bytes_allocated = 0;
+    vm->next_gc = GC_INITIAL_THRESHOLD;
+    vm->gray_count = 0;
+    vm->gray_capacity = 0;
+    vm->gray_stack = NULL;
+    vm->gc_stats = (GCStats){0};
+    vm->mem_stats = (MemStats){0};
+    vm->opt_stats = (OptStats){0};
+#ifdef QUICKEN_STATS
+    vm->quicken_stats = (QuickenStats){0};
+#endif
+#ifdef PROFILE_OPCODES
+    vm->profile = (OpcodeProfile){0};
+    vm->profile.previous = -1;
+    vm->profile.before = -1;
+#endif
+    init_pool(&vm->pool);
+    init_table(&vm->strings);
+    init_output(&vm->output, stdout);
+    vm->errors = stderr;
+    vm->listings = true;
+    vm->script_code = NULL;
+    vm->script_code_capacity = 0;
+    vm->script_id = 0;
 
-Value pop() {
-    --vm.stack_top;
-    return *vm.stack_top;
+    vm->stack = ALLOCATE(vm, Value, STACK_MAX, MEM_STACK);
+    vm->stack_capacity = STACK_MAX;
+    reset_stack(vm);
 }
 
-static Value peek(int distance) {
-    return vm.stack_top[-1-distance];
+// forgets whatever the last run left behind, keeping everything it allocated (the stack, the intern table, the
+// heap and the pools) warm for the next one
+void reset_vm(VM* vm) {
+    reset_stack(vm);
+    vm->result = NIL_VAL;
+    vm->chunk = NULL;
+    vm->compiling = NULL;
 }
 
-static bool is_falsey(Value value) {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)) || (IS_NUMBER(value) && (AS_NUMBER(value) == 0));
+void free_vm(VM* vm) {
+    flush_output(&vm->output);
+    free_table(vm, &vm->strings);
+    free_objects(vm);
+    FREE_ARRAY(vm, Value, vm->stack, vm->stack_capacity, MEM_STACK);
+    FREE_ARRAY(vm, uint8_t, vm->script_code, vm->script_code_capacity, MEM_CHUNK_CODE);
+    free_pool(&vm->pool);
 }
 
-static void concatenate() {
-    ObjString* b = AS_STRING(pop());
-    ObjString* a = AS_STRING(pop());
+void push(VM* vm, Value value) {
+    *vm->stack_top = value;
+    ++vm->stack_top;
+}
 
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+Value pop(VM* vm) {
+    --vm->stack_top;
+    return *vm->stack_top;
+}
 
-    ObjString* result = take_string(chars, length);
-    push(OBJ_VAL(result));
+static Value peek(VM* vm, int distance) {
+    return vm->stack_top[-1-distance];
 }
 
-static bool values_equal(Value a, Value b) {
-    if (a.type != b.type) { return false; }
-    switch (a.type) {
-        case VAL_NIL: { return true; }
-        case VAL_BOOL: { return AS_BOOL(a) == AS_BOOL(b);}
-        case VAL_NUMBER: { return AS_NUMBER(a) == AS_NUMBER(b); }
-        default: return false;
-    }
+static void concatenate(VM* vm) {
+    // leave the operands on the stack until the result exists, the allocation below may run the collector
+    ObjString* b = AS_STRING(peek(vm, 0));
+    ObjString* a = AS_STRING(peek(vm, 1));
+
+    ObjString* result = concat_strings(vm, a, b);
+    pop(vm);
+    pop(vm);
+    push(vm, OBJ_VAL(result));
 }
 
-static InterpretResult run() {
-#define READ_BYTE() (*vm.ip++)
-#define READ_CONSTANT() (vm.chunk->constants.values[*vm.ip++])
-#define BINARY_OP(value_type, op) \
+#ifdef QUICKEN_STATS
+#define COUNT_QUICKEN(counter) (++vm->quicken_stats.counter)
+#else
+#define COUNT_QUICKEN(counter) ((void)0)
+#endif
+
+static InterpretResult run(VM* vm) {
+#define READ_BYTE() (*vm->ip++)
+#define READ_CONSTANT() (vm->chunk->constants.values[*vm->ip++])
+#define READ_CONSTANT_LONG() \
+    (vm->ip += 3, vm->chunk->constants.values[vm->ip[-3] | (vm->ip[-2] << 8) | (vm->ip[-1] << 16)])
+// every quickenable op is a single byte, so the opcode being executed is always at ip[-1]
+#define QUICKEN(specialized) \
     do { \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtime_error("Operands must be numbers."); \
+        vm->ip[-1] = specialized; \
+        COUNT_QUICKEN(quickened); \
+    } while (false)
+// guard failed: put the generic op back and run it on these operands instead (it may quicken the site again).
+// The profiler has already counted this instruction once, so it's moved over to generic rather than counted again.
+#ifdef PROFILE_OPCODES
+#define DEOPT(generic) \
+    { \
+        vm->ip[-1] = generic; \
+        --vm->ip; \
+        COUNT_QUICKEN(deopts); \
+        profile_deopt(vm, generic); \
+        DISPATCH_UNPROFILED(); \
+    }
+#else
+#define DEOPT(generic) \
+    { \
+        vm->ip[-1] = generic; \
+        --vm->ip; \
+        COUNT_QUICKEN(deopts); \
+        DISPATCH(); \
+    }
+#endif
+#define BINARY_OP(value_type, op, specialized) \
+    do { \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+            runtime_error(vm, "Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERR; \
+        } \
+        COUNT_QUICKEN(generic); \
+        QUICKEN(specialized); \
+        double b = AS_NUMBER(pop(vm)); \
+        double a = AS_NUMBER(pop(vm)); \
+        push(vm, value_type(a op b)); \
+    } while (false)
+// the guard (both operands numbers) has already been checked
+#define BINARY_OP_NUM(value_type, op) \
+    do { \
+        COUNT_QUICKEN(specialized); \
+        double b = AS_NUMBER(pop(vm)); \
+        vm->stack_top[-1] = value_type(AS_NUMBER(vm->stack_top[-1]) op b); \
+    } while (false)
+// the right operand comes from the constant pool and the result overwrites the left one in place
+#define BINARY_OP_CONST(value_type, op) \
+    do { \
+        Value b = READ_CONSTANT(); \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(b)) { \
+            runtime_error(vm, "Operands must be numbers."); \
             return INTERPRET_RUNTIME_ERR; \
         } \
-        double b = AS_NUMBER(pop()); \
-        double a = AS_NUMBER(pop()); \
-        push(value_type(a op b)); \
+        vm->stack_top[-1] = value_type(AS_NUMBER(peek(vm, 0)) op AS_NUMBER(b)); \
     } while (false)
 
-    for(;;) {
-        uint8_t instruction = READ_BYTE();
+#ifdef COMPUTED_GOTO
+    // one label per opcode, and every handler ends with its own indirect jump instead of looping back to a
+    // single shared one, so the branch predictor gets a separate history for each handler
+    static void* dispatch_table[] = {
+        [OP_CONSTANT] = &&do_OP_CONSTANT,
+        [OP_NEGATE] = &&do_OP_NEGATE,
+        [OP_ADD] = &&do_OP_ADD,
+        [OP_SUBTRACT] = &&do_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&do_OP_MULTIPLY,
+        [OP_DIVIDE] = &&do_OP_DIVIDE,
+        [OP_RETURN] = &&do_OP_RETURN,
+        [OP_NIL] = &&do_OP_NIL,
+        [OP_TRUE] = &&do_OP_TRUE,
+        [OP_FALSE] = &&do_OP_FALSE,
+        [OP_NOT] = &&do_OP_NOT,
+        [OP_EQUAL] = &&do_OP_EQUAL,
+        [OP_GREATER] = &&do_OP_GREATER,
+        [OP_LESS] = &&do_OP_LESS,
+        [OP_ADD_CONST] = &&do_OP_ADD_CONST,
+        [OP_SUBTRACT_CONST] = &&do_OP_SUBTRACT_CONST,
+        [OP_MULTIPLY_CONST] = &&do_OP_MULTIPLY_CONST,
+        [OP_DIVIDE_CONST] = &&do_OP_DIVIDE_CONST,
+        [OP_GREATER_CONST] = &&do_OP_GREATER_CONST,
+        [OP_LESS_CONST] = &&do_OP_LESS_CONST,
+        [OP_CONSTANT_LONG] = &&do_OP_CONSTANT_LONG,
+        [OP_GET_INPUT] = &&do_OP_GET_INPUT,
+        [OP_ADD_NUM_NUM] = &&do_OP_ADD_NUM_NUM,
+        [OP_ADD_STR_STR] = &&do_OP_ADD_STR_STR,
+        [OP_SUBTRACT_NUM_NUM] = &&do_OP_SUBTRACT_NUM_NUM,
+        [OP_MULTIPLY_NUM_NUM] = &&do_OP_MULTIPLY_NUM_NUM,
+        [OP_DIVIDE_NUM_NUM] = &&do_OP_DIVIDE_NUM_NUM,
+        [OP_GREATER_NUM_NUM] = &&do_OP_GREATER_NUM_NUM,
+        [OP_LESS_NUM_NUM] = &&do_OP_LESS_NUM_NUM,
+    };
+#ifdef PROFILE_OPCODES
+#define DISPATCH_START() profile_step(vm, *vm->ip); goto *dispatch_table[READ_BYTE()];
+#define DISPATCH() do { profile_step(vm, *vm->ip); goto *dispatch_table[READ_BYTE()]; } while (false)
+#define DISPATCH_UNPROFILED() goto *dispatch_table[READ_BYTE()]
+#else
+#define DISPATCH_START() goto *dispatch_table[READ_BYTE()];
+#define DISPATCH() goto *dispatch_table[READ_BYTE()]
+#endif
+#define CASE(op) do_##op
+#else
+#ifdef PROFILE_OPCODES
+#define DISPATCH_START() profile_step(vm, *vm->ip); dispatch_unprofiled: switch (READ_BYTE())
+#define DISPATCH_UNPROFILED() goto dispatch_unprofiled
+#else
+#define DISPATCH_START() switch (READ_BYTE())
+#endif
+#define DISPATCH() continue
+#define CASE(op) case op
+#endif
 
-        switch (instruction) {
-            case OP_RETURN: {
-                print_value(pop());
-                printf("\n");
+    for(;;) {
+        DISPATCH_START()
+        {
+            CASE(OP_RETURN): {
+                vm->result = pop(vm);
+#ifdef PROFILE_OPCODES
+                profile_step(vm, -1);
+#endif
                 return INTERPRET_OK;
             }
-            case OP_CONSTANT: {
+            CASE(OP_CONSTANT): {
                 Value constant = READ_CONSTANT();
-                push(constant);
-                break;
-            }
-            case OP_NIL: { push(NIL_VAL); break; }
-            case OP_TRUE: { push(BOOL_VAL(true)); break; }
-            case OP_FALSE : { push(BOOL_VAL(false)); break; }
-            case OP_NOT: {
-                push(BOOL_VAL(is_falsey(pop())));
-                break;
-            }
-            case OP_NEGATE: {
-                if (!IS_NUMBER(peek(0))) {
-                    runtime_error("operand must be a number");
+                push(vm, constant);
+                DISPATCH();
+            }
+            CASE(OP_CONSTANT_LONG): {
+                Value constant = READ_CONSTANT_LONG();
+                push(vm, constant);
+                DISPATCH();
+            }
+            CASE(OP_GET_INPUT): {
+                push(vm, vm->stack[READ_BYTE()]);
+                DISPATCH();
+            }
+            CASE(OP_NIL): { push(vm, NIL_VAL); DISPATCH(); }
+            CASE(OP_TRUE): { push(vm, BOOL_VAL(true)); DISPATCH(); }
+            CASE(OP_FALSE): { push(vm, BOOL_VAL(false)); DISPATCH(); }
+            CASE(OP_NOT): {
+                push(vm, BOOL_VAL(is_falsey(pop(vm))));
+                DISPATCH();
+            }
+            CASE(OP_NEGATE): {
+                if (!IS_NUMBER(peek(vm, 0))) {
+                    runtime_error(vm, "operand must be a number");
                     return INTERPRET_RUNTIME_ERR;
                 }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
+                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
+                DISPATCH();
             }
-            case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
+            CASE(OP_ADD): {
+                if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+                    COUNT_QUICKEN(generic);
+                    QUICKEN(OP_ADD_STR_STR);
+                    concatenate(vm);
                 }
-                else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
+                else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
+                    COUNT_QUICKEN(generic);
+                    QUICKEN(OP_ADD_NUM_NUM);
+                    double b = AS_NUMBER(pop(vm));
+                    double a = AS_NUMBER(pop(vm));
+                    push(vm, NUMBER_VAL(a + b));
                 }
                 else {
-                    runtime_error("Operands must be two numbers or two strings.");
+                    runtime_error(vm, "Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERR;
                 }
-                break;
+                DISPATCH();
+            }
+            CASE(OP_SUBTRACT): {
+                BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM_NUM);
+                DISPATCH();
+            }
+            CASE(OP_MULTIPLY): {
+                BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM_NUM);
+                DISPATCH();
+            }
+            CASE(OP_DIVIDE): {
+                BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM_NUM);
+                DISPATCH();
+            }
+            CASE(OP_EQUAL): {
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(values_equal(a, b)));
+                DISPATCH();
             }
-            case OP_SUBTRACT: {
-                BINARY_OP(NUMBER_VAL, -);
-                break;
+            CASE(OP_GREATER): {
+                BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM_NUM);
+                DISPATCH();
             }
-            case OP_MULTIPLY: {
-                BINARY_OP(NUMBER_VAL, *);
-                break;
+            CASE(OP_LESS): {
+                BINARY_OP(BOOL_VAL, <, OP_LESS_NUM_NUM);
+                DISPATCH();
             }
-            case OP_DIVIDE: {
-                BINARY_OP(NUMBER_VAL, /);
-                break;
+            CASE(OP_ADD_NUM_NUM): {
+                if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) DEOPT(OP_ADD)
+                BINARY_OP_NUM(NUMBER_VAL, +);
+                DISPATCH();
             }
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(values_equal(a, b)));
-                break;
+            CASE(OP_ADD_STR_STR): {
+                if (!IS_STRING(peek(vm, 0)) || !IS_STRING(peek(vm, 1))) DEOPT(OP_ADD)
+                COUNT_QUICKEN(specialized);
+                concatenate(vm);
+                DISPATCH();
             }
-            case OP_GREATER: {
-                BINARY_OP(BOOL_VAL, >);
-                break;
+            CASE(OP_SUBTRACT_NUM_NUM): {
+                if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) DEOPT(OP_SUBTRACT)
+                BINARY_OP_NUM(NUMBER_VAL, -);
+                DISPATCH();
             }
-            case OP_LESS: {
-                BINARY_OP(BOOL_VAL, <);
-                break;
+            CASE(OP_MULTIPLY_NUM_NUM): {
+                if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) DEOPT(OP_MULTIPLY)
+                BINARY_OP_NUM(NUMBER_VAL, *);
+                DISPATCH();
             }
-        }        
+            CASE(OP_DIVIDE_NUM_NUM): {
+                if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) DEOPT(OP_DIVIDE)
+                BINARY_OP_NUM(NUMBER_VAL, /);
+                DISPATCH();
+            }
+            CASE(OP_GREATER_NUM_NUM): {
+                if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) DEOPT(OP_GREATER)
+                BINARY_OP_NUM(BOOL_VAL, >);
+                DISPATCH();
+            }
+            CASE(OP_LESS_NUM_NUM): {
+                if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) DEOPT(OP_LESS)
+                BINARY_OP_NUM(BOOL_VAL, <);
+                DISPATCH();
+            }
+            CASE(OP_ADD_CONST): {
+                Value b = READ_CONSTANT();
+                if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(b)) {
+                    vm->stack_top[-1] = NUMBER_VAL(AS_NUMBER(peek(vm, 0)) + AS_NUMBER(b));
+                }
+                else if (IS_STRING(peek(vm, 0)) && IS_STRING(b)) {
+                    push(vm, b);
+                    concatenate(vm);
+                }
+                else {
+                    runtime_error(vm, "Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERR;
+                }
+                DISPATCH();
+            }
+            CASE(OP_SUBTRACT_CONST): {
+                BINARY_OP_CONST(NUMBER_VAL, -);
+                DISPATCH();
+            }
+            CASE(OP_MULTIPLY_CONST): {
+                BINARY_OP_CONST(NUMBER_VAL, *);
+                DISPATCH();
+            }
+            CASE(OP_DIVIDE_CONST): {
+                BINARY_OP_CONST(NUMBER_VAL, /);
+                DISPATCH();
+            }
+            CASE(OP_GREATER_CONST): {
+                BINARY_OP_CONST(BOOL_VAL, >);
+                DISPATCH();
+            }
+            CASE(OP_LESS_CONST): {
+                BINARY_OP_CONST(BOOL_VAL, <);
+                DISPATCH();
+            }
+        }
     }
 
+#undef CASE
+#undef DISPATCH
+#undef DISPATCH_START
+#undef BINARY_OP_CONST
+#undef BINARY_OP_NUM
 #undef BINARY_OP
+#undef DEOPT
+#undef QUICKEN
+#undef READ_CONSTANT_LONG
 #undef READ_CONSTANT
 #undef READ_BYTE
 }
 
-InterpretResult interpret(const char* src) {
+InterpretResult interpret(VM* vm, const char* src) {
     Chunk chunk;
     init_chunk(&chunk);
 
-    if(!compile(src, &chunk)) {
-        free_chunk(&chunk);
+    InterpretResult result = compile_chunk(vm, src, &chunk);
+    if (result == INTERPRET_OK) {
+        result = interpret_chunk(vm, &chunk);
+    }
+    free_chunk(vm, &chunk);
+    return result;
+}
+
+// compiles and optimizes src into chunk without running it. The constants are only rooted while this runs, so
+// nothing may allocate between this and interpret_chunk() / free_chunk().
+InterpretResult compile_chunk(VM* vm, const char* src, Chunk* chunk) {
+    reset_stack(vm);
+    if (!compile(vm, src, chunk)) {
         return INTERPRET_COMPILE_ERR;
-    }    
+    }
+
+    // rooted from here on: the optimizer can allocate
+    vm->chunk = chunk;
+    if (vm->listings) {
+        flush_output(&vm->output);   // the listings go straight to stdout, after whatever earlier runs printed
+        disassemble_chunk(chunk, "Expression Chunk");
+    }
+
+    int before = vm->opt_stats.rewrites;
+    optimize_chunk(vm, chunk, &vm->opt_stats);
+    if (vm->listings && vm->opt_stats.rewrites != before) {
+        disassemble_chunk(chunk, "Optimized Chunk");
+    }
+
+    vm->chunk = NULL;
+    return INTERPRET_OK;
+}
 
-    disassemble_chunk(&chunk, "Expression Chunk");
+// runs a chunk from compile_chunk() or load_chunk_cache() and prints what it returns; the caller still owns and
+// frees it
+InterpretResult interpret_chunk(VM* vm, Chunk* chunk) {
+    if (chunk->input_count > 0) {
+        fprintf(vm->errors, "Script reads $%d, but only a host can pass inputs.\n", chunk->input_count - 1);
+        return INTERPRET_RUNTIME_ERR;
+    }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
-    init_vm();
+    reset_stack(vm);
+    vm->chunk = chunk;   // rooted: ensure_stack() can allocate
+    ensure_stack(vm, chunk);
+    vm->ip = chunk->code;
 
-    InterpretResult result = run();
+    InterpretResult result = run(vm);
 
-    free_chunk(&chunk);
+    vm->chunk = NULL;
+    if (result == INTERPRET_OK) {
+        write_value(&vm->output, vm->result);
+        write_output(&vm->output, "\n", 1);
+    }
     return result;
+}
+
+// compiles src once for run_script(); compile errors are reported and give NULL
+Script* compile_script(const char* src) {
+    Script* script = malloc(sizeof(Script));
+    init_vm(&script->heap);
+    script->heap.listings = false;
+    init_chunk(&script->chunk);
+    script->id = atomic_fetch_add(&next_script_id, 1);
+    if (compile_chunk(&script->heap, src, &script->chunk) != INTERPRET_OK) {
+        free_script(script);
+        return NULL;
+    }
+
+    // drop whatever constant folding left behind, then mark every survivor for good: other VMs' collectors stop
+    // at marked objects, so they never write to this heap, and it never allocates again to collect it itself
+    script->heap.chunk = &script->chunk;
+    collect_garbage(&script->heap);
+    script->heap.chunk = NULL;
+    for (Obj* obj = script->heap.objects; obj != NULL; obj = obj->next) {
+        obj->is_marked = true;
+    }
+    return script;
+}
+
+// no VM may be running the script, and values it returned may point into its heap
+void free_script(Script* script) {
+    free_chunk(&script->heap, &script->chunk);
+    free_vm(&script->heap);
+    free(script);
+}
+
+// runs script on vm with inputs in $0, $1, ... and stores what it returns in result (when that isn't NULL). Inputs
+// must be values from vm's heap or from a script's; a returned string lives until vm's next collection, or for as
+// long as the script does if it's one of the script's constants.
+InterpretResult run_script(VM* vm, Script* script, const Value* inputs, int input_count, Value* result) {
+    Chunk* shared = &script->chunk;
+    if (input_count < shared->input_count) {
+        fprintf(vm->errors, "Script reads $%d, but was given %d inputs.\n", shared->input_count - 1, input_count);
+        return INTERPRET_RUNTIME_ERR;
+    }
+
+    // the inputs go on the stack first so they're rooted through everything below that can allocate; there are
+    // at most 256 of them, which always fits the initial stack
+    reset_stack(vm);
+    for (int i = 0; i < shared->input_count; ++i) {
+        push(vm, inputs[i]);
+    }
+    Chunk chunk = *shared;
+    chunk.max_stack += shared->input_count;
+    ensure_stack(vm, &chunk);
+    if (vm->script_id != script->id) {
+        if (vm->script_code_capacity < shared->count) {
+            int old_capacity = vm->script_code_capacity;
+            vm->script_code_capacity = shared->count;
+            vm->script_code = GROW_ARRAY(vm, uint8_t, vm->script_code, old_capacity, shared->count, MEM_CHUNK_CODE);
+        }
+        memcpy(vm->script_code, shared->code, shared->count);
+        vm->script_id = script->id;
+    }
+    chunk.code = vm->script_code;
+
+    vm->chunk = &chunk;
+    vm->ip = chunk.code;
+    InterpretResult status = run(vm);
+    vm->chunk = NULL;
+    if (status == INTERPRET_OK && result != NULL) {
+        *result = vm->result;
+    }
+    return status;
 }
\ No newline at end of file